@@ -1,16 +1,50 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <initializer_list>
 #include <iterator>
+#include <linux/perf_event.h>
 #include <list>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <new>
+#include <numeric>
+#include <pthread.h>
 #include <scoped_allocator>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#ifdef POOL_NEW
+#include "../common/pool_new.h"
+#endif
+
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
 // Refresher - Interfaces versus concepts
@@ -614,67 +648,290 @@ namespace ex15
         }
     };
 
+    // A Chunk is a header placed at the front of a block obtained from the
+    // upstream resource; its payload follows the header in the same block.
+    // Every ChunkyPtr carries a pointer to its Chunk, so deallocation never
+    // has to search for the owner.
     class Chunk
     {
       private:
-        char buffer[10000];
-        int  index = 0;
-        int  freed = 0;
+        Chunk  *m_prev = nullptr;
+        Chunk  *m_next = nullptr;
+        Chunk **m_list = nullptr; // head of the list this chunk is filed on
+        size_t  m_capacity;
+        size_t  m_offset;
+        size_t  m_align;
+        size_t  m_index = 0;
+        size_t  m_freed = 0;
+        bool    m_huge;
+
+        friend class ChunkyMemoryResource;
+
+        char *
+        data()
+        {
+            return reinterpret_cast<char *>(this) + m_offset;
+        }
 
       public:
+        explicit Chunk(size_t capacity, size_t offset, size_t align, bool huge)
+            : m_capacity(capacity), m_offset(offset), m_align(align), m_huge(huge)
+        {
+        }
+
+        size_t
+        available() const
+        {
+            return m_capacity - m_index;
+        }
+
         bool
-        can_allocate(size_t bytes)
+        can_allocate(size_t bytes) const
         {
-            return (sizeof buffer - index) >= bytes;
+            return available() >= bytes;
         }
 
         auto
         allocate(size_t bytes)
         {
-            index += bytes;
-            void *p = &buffer[index - bytes];
+            m_index += bytes;
+            void *p = data() + (m_index - bytes);
             return ChunkyPtr<void>(p, this);
         }
 
-        void
-        deallocate(void *, size_t bytes)
+        // Returns true when the chunk has become completely free.
+        bool
+        deallocate(void *p, size_t bytes)
         {
-            freed += bytes;
-            if (freed == index)
+            if (static_cast<char *>(p) + bytes == data() + m_index)
+            {
+                // aha! we can roll back our index!
+                m_index -= bytes;
+            }
+            else
+            {
+                m_freed += bytes;
+            }
+            if (m_freed == m_index)
             {
-                index = freed = 0;
+                m_index = m_freed = 0;
+                return true;
             }
+            return false;
         }
     };
 
+    struct ChunkyOptions
+    {
+        size_t chunk_size       = 64 * 1024; // payload bytes per regular chunk
+        size_t huge_threshold   = 16 * 1024; // bigger requests get a chunk of their own
+        size_t max_empty_chunks = 2;         // empty chunks past this go back upstream
+    };
+
+    // Chunks with room left are filed into buckets by floor(log2(available())).
+    // A request for n bytes can be served by the head of any non-empty bucket
+    // at or above ceil(log2(n)), and a bitmask of the non-empty buckets finds
+    // the first such bucket in O(1).
     class ChunkyMemoryResource
     {
       private:
-        std::list<Chunk> m_chunks;
+        static constexpr size_t granule     = alignof(std::max_align_t);
+        static constexpr int    num_buckets = 64;
+
+        ChunkyOptions              m_options;
+        std::pmr::memory_resource *m_upstream;
+        Chunk                     *m_buckets[num_buckets] = {};
+        std::uint64_t              m_nonempty             = 0;
+        Chunk                     *m_full                 = nullptr;
+        Chunk                     *m_empty                = nullptr;
+        Chunk                     *m_huge                 = nullptr;
+        size_t                     m_empty_count          = 0;
+        size_t                     m_chunk_count          = 0;
+
+        static size_t
+        round_up(size_t n, size_t align)
+        {
+            return n + (-n % align);
+        }
+
+        void
+        push(Chunk **list, Chunk *ch)
+        {
+            ch->m_list = list;
+            ch->m_prev = nullptr;
+            ch->m_next = *list;
+            if (*list)
+            {
+                (*list)->m_prev = ch;
+            }
+            *list = ch;
+            if (list >= m_buckets && list < m_buckets + num_buckets)
+            {
+                m_nonempty |= std::uint64_t(1) << (list - m_buckets);
+            }
+        }
+
+        void
+        unlink(Chunk *ch)
+        {
+            Chunk **list = ch->m_list;
+            if (ch->m_prev)
+            {
+                ch->m_prev->m_next = ch->m_next;
+            }
+            else
+            {
+                *list = ch->m_next;
+            }
+            if (ch->m_next)
+            {
+                ch->m_next->m_prev = ch->m_prev;
+            }
+            if (*list == nullptr && list >= m_buckets && list < m_buckets + num_buckets)
+            {
+                m_nonempty &= ~(std::uint64_t(1) << (list - m_buckets));
+            }
+            ch->m_list = nullptr;
+        }
+
+        // File a partially used chunk under the bucket matching its free space.
+        void
+        file(Chunk *ch)
+        {
+            size_t avail = ch->available();
+            if (avail < granule)
+            {
+                push(&m_full, ch);
+            }
+            else
+            {
+                push(&m_buckets[std::bit_width(avail) - 1], ch);
+            }
+        }
+
+        Chunk *
+        new_chunk(size_t capacity, size_t align, bool huge)
+        {
+            align         = std::max(align, alignof(Chunk));
+            size_t offset = round_up(sizeof(Chunk), std::max(align, granule));
+            void  *raw    = m_upstream->allocate(offset + capacity, align);
+            ++m_chunk_count;
+            return ::new (raw) Chunk(capacity, offset, align, huge);
+        }
+
+        void
+        release(Chunk *ch)
+        {
+            size_t bytes = ch->m_offset + ch->m_capacity;
+            size_t align = ch->m_align;
+            ch->~Chunk();
+            m_upstream->deallocate(ch, bytes, align);
+            --m_chunk_count;
+        }
+
+        void
+        release_list(Chunk *&list)
+        {
+            while (Chunk *ch = list)
+            {
+                list = ch->m_next;
+                release(ch);
+            }
+        }
 
       public:
+        explicit ChunkyMemoryResource(ChunkyOptions              options  = {},
+                                      std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+            : m_options(options), m_upstream(upstream)
+        {
+            m_options.chunk_size     = round_up(std::max(m_options.chunk_size, granule), granule);
+            m_options.huge_threshold = std::min(m_options.huge_threshold, m_options.chunk_size);
+        }
+
+        ChunkyMemoryResource(const ChunkyMemoryResource &)            = delete;
+        ChunkyMemoryResource &operator=(const ChunkyMemoryResource &) = delete;
+
+        ~ChunkyMemoryResource()
+        {
+            for (auto &&list : m_buckets)
+            {
+                release_list(list);
+            }
+            release_list(m_full);
+            release_list(m_empty);
+            release_list(m_huge);
+        }
+
         ChunkyPtr<void>
         allocate(size_t bytes, size_t align)
         {
-            assert(align <= alignof(std::max_align_t));
-            bytes += -bytes % alignof(std::max_align_t);
-            assert(bytes <= 10000);
+            bytes = round_up(std::max<size_t>(bytes, 1), granule);
 
-            for (auto &&ch : m_chunks)
+            if (align > granule || bytes > m_options.huge_threshold)
             {
-                if (ch.can_allocate(bytes))
-                {
-                    return ch.allocate(bytes);
-                }
+                // Serve it directly from upstream, with a chunk of its own.
+                Chunk *ch = new_chunk(bytes, align, true);
+                push(&m_huge, ch);
+                return ch->allocate(bytes);
+            }
+
+            int           b          = std::bit_width(bytes - 1);
+            std::uint64_t candidates = m_nonempty >> b << b;
+            Chunk        *ch;
+            if (candidates)
+            {
+                ch = m_buckets[std::countr_zero(candidates)];
+                unlink(ch);
+            }
+            else if (m_empty)
+            {
+                ch = m_empty;
+                unlink(ch);
+                --m_empty_count;
             }
-            return m_chunks.emplace_back().allocate(bytes);
+            else
+            {
+                ch = new_chunk(m_options.chunk_size, granule, false);
+            }
+            auto p = ch->allocate(bytes);
+            file(ch);
+            return p;
         }
 
         void
         deallocate(ChunkyPtr<void> p, size_t bytes, size_t)
         {
-            bytes += -bytes % alignof(std::max_align_t);
-            p.chunk()->deallocate(static_cast<void *>(p), bytes);
+            Chunk *ch = p.chunk();
+            unlink(ch);
+            if (ch->m_huge)
+            {
+                release(ch);
+            }
+            else if (!ch->deallocate(static_cast<void *>(p), round_up(std::max<size_t>(bytes, 1), granule)))
+            {
+                file(ch);
+            }
+            else if (m_empty_count < m_options.max_empty_chunks)
+            {
+                push(&m_empty, ch);
+                ++m_empty_count;
+            }
+            else
+            {
+                release(ch);
+            }
+        }
+
+        size_t
+        chunk_count() const
+        {
+            return m_chunk_count;
+        }
+
+        size_t
+        empty_chunk_count() const
+        {
+            return m_empty_count;
         }
     };
 
@@ -731,6 +988,53 @@ namespace ex15
 
         // std::list<int, AllocOfInt> lst{&mr};
         // lst.push_back(42);
+
+        AllocOfInt a(&mr);
+        auto       p = std::allocator_traits<AllocOfInt>::allocate(a, 10);
+        *p           = 42;
+        assert(p.chunk() != nullptr && *p == 42);
+        std::allocator_traits<AllocOfInt>::deallocate(a, p, 10);
+    }
+
+    void
+    test2()
+    {
+        ChunkyMemoryResource mr({.chunk_size = 1024, .huge_threshold = 256, .max_empty_chunks = 1});
+
+        // Nine 112-byte blocks fit in a 1024-byte chunk; the tenth needs another.
+        std::vector<ChunkyPtr<void>> ps;
+        for (int i = 0; i < 10; ++i)
+        {
+            ps.push_back(mr.allocate(100, 8));
+        }
+        assert(mr.chunk_count() == 2);
+        assert(ps[0].chunk() == ps[8].chunk() && ps[8].chunk() != ps[9].chunk());
+
+        // Freeing the newest block rolls the index back, so it is reused at once.
+        void *last = static_cast<void *>(ps[9]);
+        mr.deallocate(ps[9], 100, 8);
+        ps[9] = mr.allocate(100, 8);
+        assert(static_cast<void *>(ps[9]) == last);
+
+        // Once every block in a chunk is freed, the chunk is kept for reuse...
+        for (int i = 0; i < 9; ++i)
+        {
+            mr.deallocate(ps[i], 100, 8);
+        }
+        assert(mr.chunk_count() == 2 && mr.empty_chunk_count() == 1);
+
+        // ...but only up to the watermark; the rest go back upstream.
+        mr.deallocate(ps[9], 100, 8);
+        assert(mr.chunk_count() == 1 && mr.empty_chunk_count() == 1);
+
+        // Huge and over-aligned requests get a chunk of their own.
+        auto big = mr.allocate(5000, 8);
+        auto odd = mr.allocate(64, 256);
+        assert(mr.chunk_count() == 3);
+        assert(reinterpret_cast<std::uintptr_t>(static_cast<void *>(odd)) % 256 == 0);
+        mr.deallocate(big, 5000, 8);
+        mr.deallocate(odd, 64, 256);
+        assert(mr.chunk_count() == 1);
     }
 } // namespace ex15
 
@@ -1627,6 +1931,3347 @@ namespace ex32
     }
 } // namespace ex32
 
+// Compressed fancy pointers for relocatable heaps
+
+namespace ex38
+{
+    template <class T, class Tag>
+    class offset_ptr;
+
+    // Each Tag names one arena per process. Only "base" differs between two
+    // processes mapping the same arena, or after the arena is copied elsewhere.
+    template <class Tag>
+    struct arena
+    {
+        static inline char                                                   *base     = nullptr;
+        static inline ex19::my::fancy_memory_resource<offset_ptr<void, Tag>> *resource = nullptr;
+    };
+
+    // A 32-bit fancy pointer holding a byte offset from arena<Tag>::base.
+    // Offset 0 is the null pointer; the arena never hands out its first bytes.
+    template <class T, class Tag>
+    class offset_ptr
+    {
+        std::uint32_t m_off = 0;
+
+        template <class, class>
+        friend class offset_ptr;
+
+        static std::uint32_t
+        to_offset(const volatile void *p)
+        {
+            if (p == nullptr)
+            {
+                return 0;
+            }
+            auto d = static_cast<const char *>(const_cast<const void *>(p)) - arena<Tag>::base;
+            assert(d > 0 && d <= std::ptrdiff_t(UINT32_MAX));
+            return std::uint32_t(d);
+        }
+
+      public:
+        using iterator_category = std::random_access_iterator_tag;
+        using element_type      = T;
+        using value_type        = std::remove_cv_t<T>;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = offset_ptr;
+        using reference         = std::add_lvalue_reference_t<T>;
+
+        offset_ptr() = default;
+        offset_ptr(std::nullptr_t)
+        {
+        }
+
+        explicit offset_ptr(T *p) : m_off(to_offset(p))
+        {
+        }
+
+        template <class U>
+            requires std::is_convertible_v<U *, T *>
+        offset_ptr(offset_ptr<U, Tag> p) : m_off(to_offset(static_cast<T *>(p.get())))
+        {
+        }
+
+        template <class U>
+            requires(!std::is_convertible_v<U *, T *>) && requires(U *u) { static_cast<T *>(u); }
+        explicit offset_ptr(offset_ptr<U, Tag> p) : m_off(to_offset(static_cast<T *>(p.get())))
+        {
+        }
+
+        template <class U = T>
+            requires(!std::is_void_v<U>)
+        static offset_ptr
+        pointer_to(U &r) noexcept
+        {
+            return offset_ptr(std::addressof(r));
+        }
+
+        T *
+        get() const
+        {
+            return m_off ? static_cast<T *>(static_cast<void *>(arena<Tag>::base + m_off)) : nullptr;
+        }
+
+        std::uint32_t
+        offset() const
+        {
+            return m_off;
+        }
+
+        explicit
+        operator bool() const
+        {
+            return m_off != 0;
+        }
+
+        reference
+        operator*() const
+        {
+            return *get();
+        }
+
+        T *
+        operator->() const
+        {
+            return get();
+        }
+
+        reference
+        operator[](difference_type i) const
+        {
+            return get()[i];
+        }
+
+        offset_ptr &
+        operator+=(difference_type i)
+        {
+            m_off += i * sizeof(T);
+            return *this;
+        }
+
+        offset_ptr &
+        operator-=(difference_type i)
+        {
+            m_off -= i * sizeof(T);
+            return *this;
+        }
+
+        offset_ptr &
+        operator++()
+        {
+            return *this += 1;
+        }
+
+        offset_ptr &
+        operator--()
+        {
+            return *this -= 1;
+        }
+
+        offset_ptr
+        operator++(int)
+        {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        offset_ptr
+        operator--(int)
+        {
+            auto old = *this;
+            --*this;
+            return old;
+        }
+
+        friend offset_ptr
+        operator+(offset_ptr p, difference_type i)
+        {
+            return p += i;
+        }
+
+        friend offset_ptr
+        operator+(difference_type i, offset_ptr p)
+        {
+            return p += i;
+        }
+
+        friend offset_ptr
+        operator-(offset_ptr p, difference_type i)
+        {
+            return p -= i;
+        }
+
+        friend difference_type
+        operator-(offset_ptr a, offset_ptr b)
+        {
+            return (difference_type(a.m_off) - difference_type(b.m_off)) / difference_type(sizeof(T));
+        }
+
+        friend bool
+        operator==(offset_ptr a, offset_ptr b)
+        {
+            return a.m_off == b.m_off;
+        }
+
+        friend auto
+        operator<=>(offset_ptr a, offset_ptr b)
+        {
+            return a.m_off <=> b.m_off;
+        }
+
+        friend bool
+        operator==(offset_ptr a, std::nullptr_t)
+        {
+            return a.m_off == 0;
+        }
+    };
+
+    // A stateless allocator; it finds its resource through arena<Tag>, so a
+    // container header holds nothing but offsets and is itself relocatable.
+    template <class T, class Tag>
+    struct offset_allocator
+    {
+        using value_type      = T;
+        using pointer         = offset_ptr<T, Tag>;
+        using is_always_equal = std::true_type;
+
+        offset_allocator() = default;
+
+        template <class U>
+        offset_allocator(const offset_allocator<U, Tag> &)
+        {
+        }
+
+        pointer
+        allocate(size_t n)
+        {
+            return static_cast<pointer>(arena<Tag>::resource->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void
+        deallocate(pointer p, size_t n)
+        {
+            arena<Tag>::resource->deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        friend bool
+        operator==(const offset_allocator &, const offset_allocator &)
+        {
+            return true;
+        }
+    };
+
+    // The allocator's own bookkeeping lives at the front of the region, so the
+    // region can be copied or mapped anywhere and simply rebased.
+    template <class Tag>
+    class offset_arena : public ex19::my::fancy_memory_resource<offset_ptr<void, Tag>>
+    {
+        using VoidPtr = offset_ptr<void, Tag>;
+
+        struct header
+        {
+            std::uint32_t index;
+            std::uint32_t capacity;
+            std::uint32_t free_lists[33]; // by log2 of the block size
+        };
+
+        char *m_base;
+
+        header &
+        hdr()
+        {
+            return *reinterpret_cast<header *>(m_base);
+        }
+
+        static int
+        size_class(size_t bytes)
+        {
+            return std::bit_width(std::max<size_t>(bytes, 8) - 1);
+        }
+
+        VoidPtr
+        do_allocate(size_t bytes, size_t align) override
+        {
+            assert(align <= alignof(std::max_align_t));
+            int   cls  = size_class(bytes);
+            auto &head = hdr().free_lists[cls];
+            if (head != 0)
+            {
+                void *p = m_base + head;
+                std::memcpy(&head, p, sizeof head);
+                return VoidPtr(p);
+            }
+            size_t size  = size_t(1) << cls;
+            size_t index = hdr().index;
+            index += -index % std::min<size_t>(size, alignof(std::max_align_t));
+            if (size > hdr().capacity - index)
+            {
+                throw std::bad_alloc();
+            }
+            hdr().index = std::uint32_t(index + size);
+            return VoidPtr(m_base + index);
+        }
+
+        void
+        do_deallocate(VoidPtr p, size_t bytes, size_t) override
+        {
+            auto &head = hdr().free_lists[size_class(bytes)];
+            std::memcpy(p.get(), &head, sizeof head);
+            head = p.offset();
+        }
+
+        bool
+        do_is_equal(const ex19::my::fancy_memory_resource<VoidPtr> &rhs) const noexcept override
+        {
+            return this == &rhs;
+        }
+
+      public:
+        // Formats [p, p + size) as an empty arena, or adopts an existing one.
+        offset_arena(void *p, std::uint32_t size, bool format = true) : m_base(static_cast<char *>(p))
+        {
+            assert(size >= sizeof(header));
+            if (format)
+            {
+                hdr() = header{sizeof(header), size, {}};
+            }
+            rebase(p);
+        }
+
+        ~offset_arena()
+        {
+            if (arena<Tag>::resource == this)
+            {
+                arena<Tag>::base     = nullptr;
+                arena<Tag>::resource = nullptr;
+            }
+        }
+
+        offset_arena(const offset_arena &)            = delete;
+        offset_arena &operator=(const offset_arena &) = delete;
+
+        void
+        rebase(void *p)
+        {
+            m_base               = static_cast<char *>(p);
+            arena<Tag>::base     = m_base;
+            arena<Tag>::resource = this;
+        }
+    };
+
+    namespace my
+    {
+        template <class T, class A = std::allocator<T>>
+        class vector
+        {
+            using Traits = std::allocator_traits<A>;
+
+          public:
+            using value_type     = T;
+            using allocator_type = A;
+            using pointer        = typename Traits::pointer;
+            using const_pointer  = typename Traits::const_pointer;
+            using iterator       = pointer;
+            using const_iterator = const_pointer;
+
+          private:
+            [[no_unique_address]] A m_allocator;
+            pointer                 m_begin = nullptr;
+            pointer                 m_end   = nullptr;
+            pointer                 m_cap   = nullptr;
+
+            void
+            reallocate(size_t n)
+            {
+                pointer p  = Traits::allocate(m_allocator, n);
+                size_t  sz = size();
+                size_t  i  = 0;
+                try
+                {
+                    for (; i < sz; ++i)
+                    {
+                        Traits::construct(m_allocator, std::to_address(p + i), std::move_if_noexcept(m_begin[i]));
+                    }
+                }
+                catch (...)
+                {
+                    while (i != 0)
+                    {
+                        Traits::destroy(m_allocator, std::to_address(p + --i));
+                    }
+                    Traits::deallocate(m_allocator, p, n);
+                    throw;
+                }
+                release();
+                m_begin = p;
+                m_end   = p + sz;
+                m_cap   = p + n;
+            }
+
+            void
+            release() noexcept
+            {
+                clear();
+                if (m_begin)
+                {
+                    Traits::deallocate(m_allocator, m_begin, capacity());
+                }
+                m_begin = m_end = m_cap = nullptr;
+            }
+
+          public:
+            vector(A a = {}) : m_allocator(a)
+            {
+            }
+
+            vector(vector &&rhs) noexcept
+                : m_allocator(rhs.m_allocator), m_begin(std::exchange(rhs.m_begin, nullptr)),
+                  m_end(std::exchange(rhs.m_end, nullptr)), m_cap(std::exchange(rhs.m_cap, nullptr))
+            {
+            }
+
+            vector &operator=(const vector &) = delete;
+
+            ~vector()
+            {
+                release();
+            }
+
+            size_t
+            size() const
+            {
+                return m_end - m_begin;
+            }
+
+            size_t
+            capacity() const
+            {
+                return m_cap - m_begin;
+            }
+
+            bool
+            empty() const
+            {
+                return m_begin == m_end;
+            }
+
+            T &
+            operator[](size_t i)
+            {
+                return m_begin[i];
+            }
+
+            const T &
+            operator[](size_t i) const
+            {
+                return m_begin[i];
+            }
+
+            iterator
+            begin()
+            {
+                return m_begin;
+            }
+
+            iterator
+            end()
+            {
+                return m_end;
+            }
+
+            const_iterator
+            begin() const
+            {
+                return m_begin;
+            }
+
+            const_iterator
+            end() const
+            {
+                return m_end;
+            }
+
+            void
+            reserve(size_t n)
+            {
+                if (n > capacity())
+                {
+                    reallocate(n);
+                }
+            }
+
+            template <class... Args>
+            T &
+            emplace_back(Args &&...args)
+            {
+                if (m_end == m_cap)
+                {
+                    reallocate(std::max<size_t>(2 * capacity(), 4));
+                }
+                Traits::construct(m_allocator, std::to_address(m_end), std::forward<Args>(args)...);
+                return *m_end++;
+            }
+
+            void
+            push_back(const T &value)
+            {
+                emplace_back(value);
+            }
+
+            void
+            push_back(T &&value)
+            {
+                emplace_back(std::move(value));
+            }
+
+            void
+            pop_back()
+            {
+                Traits::destroy(m_allocator, std::to_address(--m_end));
+            }
+
+            void
+            resize(size_t n)
+            {
+                reserve(n);
+                while (size() < n)
+                {
+                    emplace_back();
+                }
+                while (size() > n)
+                {
+                    pop_back();
+                }
+            }
+
+            void
+            clear() noexcept
+            {
+                while (m_end != m_begin)
+                {
+                    pop_back();
+                }
+            }
+        };
+
+        template <class T, class A = std::allocator<T>>
+        class list
+        {
+            struct node;
+            using NodeAlloc  = typename std::allocator_traits<A>::template rebind_alloc<node>;
+            using NodeTraits = std::allocator_traits<NodeAlloc>;
+            using node_ptr   = typename NodeTraits::pointer;
+
+            // No sentinel node: a sentinel inside the list object would not be
+            // addressable by a pointer relative to the arena.
+            struct node
+            {
+                node_ptr next = nullptr;
+                node_ptr prev = nullptr;
+                T        value;
+
+                template <class... Args>
+                explicit node(Args &&...args) : value(std::forward<Args>(args)...)
+                {
+                }
+            };
+
+            [[no_unique_address]] NodeAlloc m_allocator;
+            node_ptr                        m_head = nullptr;
+            node_ptr                        m_tail = nullptr;
+            size_t                          m_size = 0;
+
+            template <class... Args>
+            node_ptr
+            make_node(Args &&...args)
+            {
+                node_ptr n = NodeTraits::allocate(m_allocator, 1);
+                try
+                {
+                    NodeTraits::construct(m_allocator, std::to_address(n), std::forward<Args>(args)...);
+                }
+                catch (...)
+                {
+                    NodeTraits::deallocate(m_allocator, n, 1);
+                    throw;
+                }
+                return n;
+            }
+
+            void
+            unlink(node_ptr n) noexcept
+            {
+                (n->prev ? n->prev->next : m_head) = n->next;
+                (n->next ? n->next->prev : m_tail) = n->prev;
+                NodeTraits::destroy(m_allocator, std::to_address(n));
+                NodeTraits::deallocate(m_allocator, n, 1);
+                --m_size;
+            }
+
+          public:
+            using value_type     = T;
+            using allocator_type = A;
+
+            static constexpr size_t node_size = sizeof(node);
+
+            class iterator
+            {
+                node_ptr    m_node = nullptr;
+                const list *m_list = nullptr;
+
+                friend class list;
+
+                iterator(node_ptr n, const list *l) : m_node(n), m_list(l)
+                {
+                }
+
+              public:
+                using iterator_category = std::bidirectional_iterator_tag;
+                using value_type        = T;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = T *;
+                using reference         = T &;
+
+                iterator() = default;
+
+                T &
+                operator*() const
+                {
+                    return m_node->value;
+                }
+
+                T *
+                operator->() const
+                {
+                    return std::addressof(m_node->value);
+                }
+
+                iterator &
+                operator++()
+                {
+                    m_node = m_node->next;
+                    return *this;
+                }
+
+                iterator &
+                operator--()
+                {
+                    m_node = m_node ? m_node->prev : m_list->m_tail;
+                    return *this;
+                }
+
+                iterator
+                operator++(int)
+                {
+                    auto old = *this;
+                    ++*this;
+                    return old;
+                }
+
+                iterator
+                operator--(int)
+                {
+                    auto old = *this;
+                    --*this;
+                    return old;
+                }
+
+                friend bool
+                operator==(const iterator &a, const iterator &b)
+                {
+                    return a.m_node == b.m_node;
+                }
+            };
+
+            list(A a = {}) : m_allocator(a)
+            {
+            }
+
+            list(const list &)            = delete;
+            list &operator=(const list &) = delete;
+
+            ~list()
+            {
+                clear();
+            }
+
+            size_t
+            size() const
+            {
+                return m_size;
+            }
+
+            bool
+            empty() const
+            {
+                return m_size == 0;
+            }
+
+            iterator
+            begin() const
+            {
+                return iterator(m_head, this);
+            }
+
+            iterator
+            end() const
+            {
+                return iterator(nullptr, this);
+            }
+
+            T &
+            front()
+            {
+                return m_head->value;
+            }
+
+            T &
+            back()
+            {
+                return m_tail->value;
+            }
+
+            template <class... Args>
+            T &
+            emplace_back(Args &&...args)
+            {
+                node_ptr n = make_node(std::forward<Args>(args)...);
+                n->prev                          = m_tail;
+                (m_tail ? m_tail->next : m_head) = n;
+                m_tail                           = n;
+                ++m_size;
+                return n->value;
+            }
+
+            template <class... Args>
+            T &
+            emplace_front(Args &&...args)
+            {
+                node_ptr n = make_node(std::forward<Args>(args)...);
+                n->next                          = m_head;
+                (m_head ? m_head->prev : m_tail) = n;
+                m_head                           = n;
+                ++m_size;
+                return n->value;
+            }
+
+            void
+            push_back(const T &value)
+            {
+                emplace_back(value);
+            }
+
+            void
+            push_front(const T &value)
+            {
+                emplace_front(value);
+            }
+
+            void
+            pop_back()
+            {
+                unlink(m_tail);
+            }
+
+            void
+            pop_front()
+            {
+                unlink(m_head);
+            }
+
+            iterator
+            erase(iterator it)
+            {
+                node_ptr next = it.m_node->next;
+                unlink(it.m_node);
+                return iterator(next, this);
+            }
+
+            void
+            clear() noexcept
+            {
+                while (m_head)
+                {
+                    unlink(m_head);
+                }
+            }
+        };
+
+        // Each node has a link for each of two bucket tables. A rehash
+        // threads the new table's chains through the links the live table
+        // doesn't use, then switches tables with a single store, so a writer
+        // that dies anywhere (ex39) leaves one whole table or the other.
+        template <class K, class V, class Hash = std::hash<K>, class Eq = std::equal_to<K>,
+                  class A = std::allocator<std::pair<const K, V>>>
+        class hash_map
+        {
+          public:
+            using key_type       = K;
+            using mapped_type    = V;
+            using value_type     = std::pair<const K, V>;
+            using allocator_type = A;
+
+          private:
+            struct node;
+            using NodeAlloc   = typename std::allocator_traits<A>::template rebind_alloc<node>;
+            using NodeTraits  = std::allocator_traits<NodeAlloc>;
+            using node_ptr    = typename NodeTraits::pointer;
+            using BucketAlloc = typename std::allocator_traits<A>::template rebind_alloc<node_ptr>;
+
+            struct node
+            {
+                node_ptr   next[2] = {};
+                value_type value;
+
+                template <class... Args>
+                explicit node(Args &&...args) : value(std::forward<Args>(args)...)
+                {
+                }
+            };
+
+            using Buckets = vector<node_ptr, BucketAlloc>;
+
+            [[no_unique_address]] NodeAlloc m_allocator;
+            [[no_unique_address]] Hash      m_hash;
+            [[no_unique_address]] Eq        m_eq;
+            Buckets                         m_tables[2];
+            unsigned char                   m_live = 0; // which table, and which of the links
+            size_t                          m_size = 0;
+
+            // Keeps the compiler from moving stores across it, so that they
+            // land in memory in program order.
+            static void
+            barrier()
+            {
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            }
+
+            const Buckets &
+            buckets() const
+            {
+                return m_tables[m_live];
+            }
+
+            Buckets &
+            buckets()
+            {
+                return m_tables[m_live];
+            }
+
+            size_t
+            bucket_of(const K &key, size_t count) const
+            {
+                return m_hash(key) % count;
+            }
+
+            size_t
+            bucket_of(const K &key) const
+            {
+                return bucket_of(key, buckets().size());
+            }
+
+            node_ptr
+            find_node(const K &key) const
+            {
+                if (buckets().empty())
+                {
+                    return nullptr;
+                }
+                for (node_ptr n = buckets()[bucket_of(key)]; n; n = n->next[m_live])
+                {
+                    if (m_eq(n->value.first, key))
+                    {
+                        return n;
+                    }
+                }
+                return nullptr;
+            }
+
+          public:
+            class iterator
+            {
+                node_ptr        m_node   = nullptr;
+                size_t          m_bucket = 0;
+                const hash_map *m_map    = nullptr;
+
+                friend class hash_map;
+
+                iterator(node_ptr n, size_t b, const hash_map *m) : m_node(n), m_bucket(b), m_map(m)
+                {
+                    skip_empty();
+                }
+
+                void
+                skip_empty()
+                {
+                    while (!m_node && ++m_bucket < m_map->buckets().size())
+                    {
+                        m_node = m_map->buckets()[m_bucket];
+                    }
+                }
+
+              public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type        = hash_map::value_type;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = value_type *;
+                using reference         = value_type &;
+
+                iterator() = default;
+
+                value_type &
+                operator*() const
+                {
+                    return m_node->value;
+                }
+
+                value_type *
+                operator->() const
+                {
+                    return std::addressof(m_node->value);
+                }
+
+                iterator &
+                operator++()
+                {
+                    m_node = m_node->next[m_map->m_live];
+                    skip_empty();
+                    return *this;
+                }
+
+                iterator
+                operator++(int)
+                {
+                    auto old = *this;
+                    ++*this;
+                    return old;
+                }
+
+                friend bool
+                operator==(const iterator &a, const iterator &b)
+                {
+                    return a.m_node == b.m_node;
+                }
+            };
+
+            hash_map(A a = {}) : m_allocator(a), m_tables{Buckets(BucketAlloc(a)), Buckets(BucketAlloc(a))}
+            {
+            }
+
+            hash_map(const hash_map &)            = delete;
+            hash_map &operator=(const hash_map &) = delete;
+
+            ~hash_map()
+            {
+                clear();
+            }
+
+            size_t
+            size() const
+            {
+                return m_size;
+            }
+
+            iterator
+            begin() const
+            {
+                return buckets().empty() ? end() : iterator(buckets()[0], 0, this);
+            }
+
+            iterator
+            end() const
+            {
+                return iterator(nullptr, buckets().size(), this);
+            }
+
+            iterator
+            find(const K &key) const
+            {
+                node_ptr n = find_node(key);
+                return n ? iterator(n, bucket_of(key), this) : end();
+            }
+
+            void
+            rehash(size_t count)
+            {
+                int      other = 1 - m_live;
+                Buckets &table = m_tables[other];
+                table.clear();
+                table.resize(count);
+                for (node_ptr head : buckets())
+                {
+                    for (node_ptr n = head; n; n = n->next[m_live])
+                    {
+                        auto &bucket   = table[bucket_of(n->value.first, count)];
+                        n->next[other] = bucket;
+                        bucket         = n;
+                    }
+                }
+                barrier();
+                m_live = (unsigned char)other;
+                barrier();
+                m_tables[1 - other].clear();
+            }
+
+            // For a map in shared memory whose last writer died holding its
+            // lock: recounts the live table, and forgets the other one (leaking
+            // its storage) in case the writer died while resizing it. Nodes
+            // the writer had not linked in yet, or had unlinked but not yet
+            // freed, are leaked too.
+            void
+            recover()
+            {
+                ::new (&m_tables[1 - m_live]) Buckets(BucketAlloc(m_allocator));
+                size_t n = 0;
+                for (auto it = begin(); it != end(); ++it)
+                {
+                    ++n;
+                }
+                m_size = n;
+            }
+
+            template <class... Args>
+            std::pair<iterator, bool>
+            try_emplace(const K &key, Args &&...args)
+            {
+                if (node_ptr n = find_node(key))
+                {
+                    return {iterator(n, bucket_of(key), this), false};
+                }
+                if (m_size >= buckets().size())
+                {
+                    rehash(std::max<size_t>(2 * buckets().size(), 8));
+                }
+                node_ptr n = NodeTraits::allocate(m_allocator, 1);
+                try
+                {
+                    NodeTraits::construct(m_allocator, std::to_address(n), std::piecewise_construct,
+                                          std::forward_as_tuple(key),
+                                          std::forward_as_tuple(std::forward<Args>(args)...));
+                }
+                catch (...)
+                {
+                    NodeTraits::deallocate(m_allocator, n, 1);
+                    throw;
+                }
+                size_t b        = bucket_of(key);
+                n->next[m_live] = buckets()[b];
+                barrier();
+                buckets()[b] = n;
+                barrier();
+                ++m_size;
+                return {iterator(n, b, this), true};
+            }
+
+            V &
+            operator[](const K &key)
+            {
+                return try_emplace(key).first->second;
+            }
+
+            size_t
+            erase(const K &key)
+            {
+                if (buckets().empty())
+                {
+                    return 0;
+                }
+                for (node_ptr *link = &buckets()[bucket_of(key)]; *link; link = &(*link)->next[m_live])
+                {
+                    node_ptr n = *link;
+                    if (m_eq(n->value.first, key))
+                    {
+                        *link = n->next[m_live];
+                        barrier();
+                        NodeTraits::destroy(m_allocator, std::to_address(n));
+                        NodeTraits::deallocate(m_allocator, n, 1);
+                        --m_size;
+                        return 1;
+                    }
+                }
+                return 0;
+            }
+
+            void
+            clear() noexcept
+            {
+                for (node_ptr &head : buckets())
+                {
+                    while (node_ptr n = head)
+                    {
+                        head = n->next[m_live];
+                        barrier();
+                        NodeTraits::destroy(m_allocator, std::to_address(n));
+                        NodeTraits::deallocate(m_allocator, n, 1);
+                    }
+                }
+                m_size = 0;
+            }
+        };
+    } // namespace my
+
+    struct demo_arena;
+
+    template <class T>
+    using DemoAlloc = offset_allocator<T, demo_arena>;
+
+    void
+    test()
+    {
+        static_assert(sizeof(offset_ptr<int, demo_arena>) == 4);
+        using VoidPtr = std::allocator_traits<DemoAlloc<int>>::void_pointer;
+        static_assert(std::is_same_v<VoidPtr, offset_ptr<void, demo_arena>>);
+
+        // Two 32-bit links instead of two 64-bit ones halve the node.
+        static_assert(my::list<int, DemoAlloc<int>>::node_size * 2 == my::list<int>::node_size);
+
+        constexpr std::uint32_t  size = 1 << 16;
+        auto                     buf  = std::make_unique<char[]>(size);
+        auto                     copy = std::make_unique<char[]>(size);
+        offset_arena<demo_arena> mr(buf.get(), size);
+
+        my::vector<int, DemoAlloc<int>> v;
+        my::list<int, DemoAlloc<int>>   lst;
+        my::hash_map<int, int, std::hash<int>, std::equal_to<int>, DemoAlloc<std::pair<const int, int>>> m;
+        for (int i = 0; i < 100; ++i)
+        {
+            v.push_back(i);
+            lst.push_back(i);
+            m[i] = i * i;
+        }
+        m.erase(50);
+
+        // Move the whole heap somewhere else. Nothing in it, nor in the
+        // container headers above, holds an absolute address.
+        std::memcpy(copy.get(), buf.get(), size);
+        std::memset(buf.get(), 0xff, size);
+        mr.rebase(copy.get());
+
+        assert(v.size() == 100 && v[42] == 42);
+        assert(std::accumulate(lst.begin(), lst.end(), 0) == 4950 && *--lst.end() == 99);
+        assert(m.size() == 99 && m.find(7)->second == 49 && m.find(50) == m.end());
+        int count = 0;
+        for (auto &&kv : m)
+        {
+            count += (kv.second == kv.first * kv.first);
+        }
+        assert(count == 99);
+
+        // The same containers work with raw pointers, too.
+        my::hash_map<int, my::list<int>> plain;
+        plain[1].push_back(2);
+        assert(plain.find(1)->second.front() == 2);
+    }
+} // namespace ex38
+
+// Sharing containers between processes
+
+namespace ex39
+{
+    using ex38::arena;
+    using ex38::offset_allocator;
+    using ex38::offset_ptr;
+
+    // A pthread mutex that lives in shared memory and survives the death of
+    // its owner: the next locker gets EOWNERDEAD, repairs whatever the dead
+    // owner may have left half-updated, and marks the mutex consistent.
+    class robust_mutex
+    {
+        pthread_mutex_t            m_mutex;
+        std::atomic<std::uint32_t> m_recoveries{0};
+
+      public:
+        robust_mutex()
+        {
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            pthread_mutex_init(&m_mutex, &attr);
+            pthread_mutexattr_destroy(&attr);
+        }
+
+        robust_mutex(const robust_mutex &)            = delete;
+        robust_mutex &operator=(const robust_mutex &) = delete;
+
+        ~robust_mutex()
+        {
+            pthread_mutex_destroy(&m_mutex);
+        }
+
+        // If the previous owner died inside its critical section, runs
+        // recover() under the lock before marking the mutex consistent. If
+        // recover() throws, the mutex is unlocked still inconsistent, which
+        // retires it: this and every later lock() throws ENOTRECOVERABLE.
+        template <class F>
+        void
+        lock(F recover)
+        {
+            int rc = pthread_mutex_lock(&m_mutex);
+            if (rc == EOWNERDEAD)
+            {
+                try
+                {
+                    recover();
+                }
+                catch (...)
+                {
+                    pthread_mutex_unlock(&m_mutex);
+                    throw;
+                }
+                m_recoveries.fetch_add(1, std::memory_order_relaxed);
+                rc = pthread_mutex_consistent(&m_mutex);
+            }
+            if (rc != 0)
+            {
+                throw std::system_error(rc, std::generic_category(), "pthread_mutex_lock");
+            }
+        }
+
+        // Without a way to repair the data, a dead owner retires the mutex.
+        void
+        lock()
+        {
+            lock([] { throw std::system_error(ENOTRECOVERABLE, std::generic_category(), "pthread_mutex_lock"); });
+        }
+
+        void
+        unlock()
+        {
+            pthread_mutex_unlock(&m_mutex);
+        }
+
+        std::uint32_t
+        recoveries() const
+        {
+            return m_recoveries.load(std::memory_order_relaxed);
+        }
+    };
+
+    // std::lock_guard for a robust_mutex, with what to do if its last owner died.
+    template <class F>
+    class robust_lock
+    {
+        robust_mutex &m_mutex;
+
+      public:
+        robust_lock(robust_mutex &mutex, F recover) : m_mutex(mutex)
+        {
+            m_mutex.lock(std::move(recover));
+        }
+
+        robust_lock(const robust_lock &)            = delete;
+        robust_lock &operator=(const robust_lock &) = delete;
+
+        ~robust_lock()
+        {
+            m_mutex.unlock();
+        }
+    };
+
+    // A POSIX shared memory object mapped into this process.
+    class shm_segment
+    {
+        void  *m_base = nullptr;
+        size_t m_size = 0;
+
+        shm_segment(const char *name, int flags, size_t size)
+        {
+            int fd = shm_open(name, flags, 0600);
+            if (fd == -1)
+            {
+                throw std::system_error(errno, std::generic_category(), "shm_open");
+            }
+            // A segment we just created is of no use to anyone if we can't
+            // size or map it, so it mustn't outlive the failure.
+            auto fail = [&](const char *what) {
+                int err = errno;
+                close(fd);
+                if (flags & O_CREAT)
+                {
+                    shm_unlink(name);
+                }
+                throw std::system_error(err, std::generic_category(), what);
+            };
+            struct stat st;
+            if ((size != 0 && ftruncate(fd, size) == -1) || fstat(fd, &st) == -1)
+            {
+                fail("ftruncate");
+            }
+            m_size = st.st_size;
+            m_base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (m_base == MAP_FAILED)
+            {
+                fail("mmap");
+            }
+            close(fd);
+        }
+
+      public:
+        static shm_segment
+        create(const char *name, size_t size)
+        {
+            return shm_segment(name, O_RDWR | O_CREAT | O_EXCL, size);
+        }
+
+        static shm_segment
+        open(const char *name)
+        {
+            return shm_segment(name, O_RDWR, 0);
+        }
+
+        static void
+        unlink(const char *name)
+        {
+            shm_unlink(name);
+        }
+
+        shm_segment(shm_segment &&rhs) noexcept
+            : m_base(std::exchange(rhs.m_base, nullptr)), m_size(std::exchange(rhs.m_size, 0))
+        {
+        }
+
+        shm_segment &operator=(shm_segment &&) = delete;
+
+        ~shm_segment()
+        {
+            if (m_base)
+            {
+                munmap(m_base, m_size);
+            }
+        }
+
+        void *
+        data() const
+        {
+            return m_base;
+        }
+
+        size_t
+        size() const
+        {
+            return m_size;
+        }
+    };
+
+    // Allocator state at the front of the segment, shared by every process.
+    // Free lists are Treiber stacks of 32-bit offsets; the upper 32 bits of
+    // each head are a version tag that defeats ABA.
+    struct shm_header
+    {
+        static constexpr std::uint64_t magic_value = 0x6578333973686d31; // "ex39shm1"
+
+        std::uint64_t              magic = magic_value;
+        std::uint64_t              size;
+        std::atomic<std::uint64_t> index;
+        std::atomic<std::uint64_t> free_lists[33] = {};
+        robust_mutex               mutex;
+        std::atomic<std::uint32_t> root{0};
+
+        explicit shm_header(std::uint64_t sz) : size(sz), index(sizeof(shm_header))
+        {
+        }
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+    template <class Tag>
+    class shm_resource : public ex19::my::fancy_memory_resource<offset_ptr<void, Tag>>
+    {
+        using VoidPtr = offset_ptr<void, Tag>;
+
+        char       *m_base;
+        shm_header *m_hdr;
+
+        static int
+        size_class(size_t bytes)
+        {
+            return std::bit_width(std::max<size_t>(bytes, 8) - 1);
+        }
+
+        std::atomic_ref<std::uint32_t>
+        link(std::uint32_t off) const
+        {
+            return std::atomic_ref<std::uint32_t>(*reinterpret_cast<std::uint32_t *>(m_base + off));
+        }
+
+        VoidPtr
+        do_allocate(size_t bytes, size_t align) override
+        {
+            assert(align <= alignof(std::max_align_t));
+            int           cls  = size_class(bytes);
+            auto         &head = m_hdr->free_lists[cls];
+            std::uint64_t old  = head.load(std::memory_order_acquire);
+            while (std::uint32_t off = std::uint32_t(old))
+            {
+                // If another process pops this block first, "next" may be
+                // garbage, but then the tag has moved on and the CAS fails.
+                std::uint64_t next    = link(off).load(std::memory_order_relaxed);
+                std::uint64_t desired = (((old >> 32) + 1) << 32) | next;
+                if (head.compare_exchange_weak(old, desired, std::memory_order_acquire, std::memory_order_acquire))
+                {
+                    return VoidPtr(m_base + off);
+                }
+            }
+
+            size_t        size     = size_t(1) << cls;
+            size_t        align_to = std::min<size_t>(size, alignof(std::max_align_t));
+            std::uint64_t index    = m_hdr->index.load(std::memory_order_relaxed);
+            std::uint64_t start;
+            do
+            {
+                start = index + (-index % align_to);
+                if (start > m_hdr->size || size > m_hdr->size - start)
+                {
+                    throw std::bad_alloc();
+                }
+            } while (!m_hdr->index.compare_exchange_weak(index, start + size, std::memory_order_relaxed));
+            return VoidPtr(m_base + start);
+        }
+
+        void
+        do_deallocate(VoidPtr p, size_t bytes, size_t) override
+        {
+            auto         &head = m_hdr->free_lists[size_class(bytes)];
+            std::uint64_t old  = head.load(std::memory_order_relaxed);
+            std::uint64_t desired;
+            do
+            {
+                link(p.offset()).store(std::uint32_t(old), std::memory_order_relaxed);
+                desired = (((old >> 32) + 1) << 32) | p.offset();
+            } while (!head.compare_exchange_weak(old, desired, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        bool
+        do_is_equal(const ex19::my::fancy_memory_resource<VoidPtr> &rhs) const noexcept override
+        {
+            return this == &rhs;
+        }
+
+      public:
+        // The creator formats the segment; everyone else just attaches to it,
+        // wherever it happens to be mapped in their address space.
+        explicit shm_resource(const shm_segment &seg, bool format)
+            : m_base(static_cast<char *>(seg.data())), m_hdr(static_cast<shm_header *>(seg.data()))
+        {
+            assert(seg.size() <= UINT32_MAX);
+            if (format)
+            {
+                ::new (m_hdr) shm_header(seg.size());
+            }
+            assert(m_hdr->magic == shm_header::magic_value);
+            arena<Tag>::base     = m_base;
+            arena<Tag>::resource = this;
+        }
+
+        ~shm_resource()
+        {
+            if (arena<Tag>::resource == this)
+            {
+                arena<Tag>::base     = nullptr;
+                arena<Tag>::resource = nullptr;
+            }
+        }
+
+        robust_mutex &
+        mutex()
+        {
+            return m_hdr->mutex;
+        }
+
+        // Construct the segment's root object; other processes find it with root().
+        template <class T, class... Args>
+        T *
+        make_root(Args &&...args)
+        {
+            auto p = static_cast<offset_ptr<T, Tag>>(this->allocate(sizeof(T), alignof(T)));
+            ::new (p.get()) T(std::forward<Args>(args)...);
+            m_hdr->root.store(p.offset(), std::memory_order_release);
+            return p.get();
+        }
+
+        // Null until some process has called make_root().
+        template <class T>
+        T *
+        root() const
+        {
+            std::uint32_t off = m_hdr->root.load(std::memory_order_acquire);
+            return off == 0 ? nullptr : reinterpret_cast<T *>(m_base + off);
+        }
+    };
+
+    struct shared_arena;
+
+    using SharedMap = ex38::my::hash_map<int, int, std::hash<int>, std::equal_to<int>,
+                                         offset_allocator<std::pair<const int, int>, shared_arena>>;
+
+    void
+    fill(SharedMap &m, robust_mutex &mtx, int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+        {
+            robust_lock lk(mtx, [&] { m.recover(); });
+            m[i] = 2 * i;
+        }
+    }
+
+    void
+    test()
+    {
+        std::string name = "/ch08-ex39-" + std::to_string(getpid());
+
+        // A segment that can't be sized isn't left behind to block the name.
+        try
+        {
+            shm_segment::create(name.c_str(), SIZE_MAX);
+            assert(false);
+        }
+        catch (const std::system_error &e)
+        {
+            assert(e.code() == std::errc::invalid_argument);
+        }
+
+        shm_segment seg = shm_segment::create(name.c_str(), 1 << 20);
+        shm_resource<shared_arena> mr(seg, true);
+        assert(mr.root<SharedMap>() == nullptr);
+        SharedMap &m = *mr.make_root<SharedMap>();
+
+        pid_t child = fork();
+        if (child == 0)
+        {
+            // Map the segment afresh, at a different address than the parent's.
+            shm_segment                again = shm_segment::open(name.c_str());
+            shm_resource<shared_arena> cmr(again, false);
+            fill(*cmr.root<SharedMap>(), cmr.mutex(), 1000, 2000);
+            _exit(again.data() != seg.data() ? 0 : 1);
+        }
+        fill(m, mr.mutex(), 0, 1000);
+        int status;
+        waitpid(child, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        // The child rebased arena<shared_arena> in its own address space only.
+        assert(arena<shared_arena>::resource == &mr);
+        assert(m.size() == 2000 && m.find(1500)->second == 3000 && m.find(500)->second == 1000);
+
+        // A process killed while holding the lock, somewhere in the middle of
+        // inserting, erasing or rehashing, leaves a map the next locker can
+        // recover and go on using.
+        int fds[2];
+        int rc = pipe(fds);
+        assert(rc == 0);
+        (void)rc;
+        child = fork();
+        if (child == 0)
+        {
+            robust_lock lk(mr.mutex(), [&] { m.recover(); });
+            ssize_t     n = write(fds[1], "x", 1);
+            (void)n;
+            for (;;)
+            {
+                for (int i = 2000; i < 20000; ++i)
+                {
+                    m.try_emplace(i, 2 * i);
+                }
+                for (int i = 2000; i < 20000; ++i)
+                {
+                    m.erase(i);
+                }
+            }
+        }
+        char ready;
+        if (read(fds[0], &ready, 1) == 1)
+        {
+            usleep(2000);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        kill(child, SIGKILL);
+        waitpid(child, &status, 0);
+        assert(WIFSIGNALED(status));
+        {
+            robust_lock lk(mr.mutex(), [&] { m.recover(); });
+            size_t      n = 0;
+            for (auto &[k, v] : m)
+            {
+                assert(v == 2 * k);
+                ++n;
+            }
+            assert(n == m.size() && n >= 2000 && m.find(1999)->second == 3998);
+            m[-1] = -2;
+            assert(m.size() == n + 1 && m.find(-1)->second == -2);
+        }
+        assert(mr.mutex().recoveries() == 1);
+
+        // Locking without a way to recover retires the mutex instead.
+        child = fork();
+        if (child == 0)
+        {
+            mr.mutex().lock();
+            _exit(0);
+        }
+        waitpid(child, &status, 0);
+        for (int i = 0; i < 2; ++i)
+        {
+            try
+            {
+                std::lock_guard lk(mr.mutex());
+                assert(false);
+            }
+            catch (const std::system_error &e)
+            {
+                assert(e.code() == std::errc::state_not_recoverable);
+            }
+        }
+
+        m.~SharedMap();
+        shm_segment::unlink(name.c_str());
+    }
+} // namespace ex39
+
+// Profiling allocations with a memory resource
+
+namespace ex40
+{
+    // Counters for one (resource, thread) pair. Only the owning thread writes
+    // them, so plain relaxed loads and stores suffice; report() may read them
+    // concurrently from any thread.
+    struct tracking_stats
+    {
+        static constexpr int buckets = 48; // log2 of bytes, or of nanoseconds
+
+        using counter = std::atomic<std::uint64_t>;
+
+        counter allocs{0};
+        counter deallocs{0};
+        counter bytes_allocated{0};
+        counter bytes_freed{0};
+        counter size_histogram[buckets]     = {};
+        counter lifetime_histogram[buckets] = {};
+
+        static void
+        bump(counter &c, std::uint64_t n = 1)
+        {
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        static int
+        bucket(std::uint64_t n)
+        {
+            return std::min<int>(std::bit_width(n), buckets - 1);
+        }
+    };
+
+    struct tracking_report
+    {
+        std::string   tag;
+        std::uint64_t allocs          = 0;
+        std::uint64_t deallocs        = 0;
+        std::uint64_t bytes_allocated = 0;
+        std::uint64_t bytes_freed     = 0;
+        std::uint64_t peak_live_bytes = 0;
+        std::uint64_t size_histogram[tracking_stats::buckets]     = {};
+        std::uint64_t lifetime_histogram[tracking_stats::buckets] = {};
+
+        std::uint64_t
+        live_bytes() const
+        {
+            return bytes_allocated - bytes_freed;
+        }
+
+        void
+        print(FILE *fp) const
+        {
+            fprintf(fp, "tracking_resource \"%s\": %llu allocs, %llu frees, %llu bytes, %llu live, %llu peak\n",
+                    tag.c_str(), (unsigned long long)allocs, (unsigned long long)deallocs,
+                    (unsigned long long)bytes_allocated, (unsigned long long)live_bytes(),
+                    (unsigned long long)peak_live_bytes);
+            for (int i = 0; i < tracking_stats::buckets; ++i)
+            {
+                if (size_histogram[i] != 0)
+                {
+                    fprintf(fp, "    size     <= %12llu B : %llu\n", (1ull << i) - 1,
+                            (unsigned long long)size_histogram[i]);
+                }
+            }
+            for (int i = 0; i < tracking_stats::buckets; ++i)
+            {
+                if (lifetime_histogram[i] != 0)
+                {
+                    fprintf(fp, "    lifetime <= %12llu ns: %llu\n", (1ull << i) - 1,
+                            (unsigned long long)lifetime_histogram[i]);
+                }
+            }
+        }
+    };
+
+    // Sits in front of any upstream resource and records where its memory
+    // goes. The tag belongs to the resource: memory_resource::allocate() is
+    // never told who is calling, so per-call-site numbers come from giving
+    // each call site (or container) a tracking_resource of its own.
+    //
+    // Counts, bytes and histograms are per-thread, with no shared writes.
+    // Live and peak bytes are the exception: an exact peak of the sum over
+    // threads needs one shared counter, so each allocate and deallocate does
+    // one relaxed fetch_add on it, plus a CAS whenever a new peak is set.
+    // That is the price of a true peak; under heavy contention from many
+    // threads on one resource, it is the part that costs.
+    class tracking_resource : public std::pmr::memory_resource
+    {
+        struct registry
+        {
+            std::mutex                             mtx;
+            std::vector<const tracking_resource *> live;
+            std::vector<tracking_report>           retired;
+            FILE                                  *report_to = nullptr;
+            std::vector<size_t>                    free_slots;
+            size_t                                 next_slot = 0;
+        };
+
+        static registry &
+        global()
+        {
+            static registry r;
+            return r;
+        }
+
+        static inline std::atomic<std::uint64_t> s_next_id{1};
+
+        std::string                                  m_tag;
+        std::pmr::memory_resource                   *m_upstream;
+        bool                                         m_track_lifetimes;
+        std::uint64_t                                m_id = s_next_id.fetch_add(1);
+        size_t                                       m_slot; // reused once we're gone; m_id never is
+        std::atomic<std::int64_t>                    m_live{0};
+        std::atomic<std::int64_t>                    m_peak{0};
+        mutable std::mutex                           m_mtx; // guards m_threads only
+        std::vector<std::unique_ptr<tracking_stats>> m_threads;
+
+        // Each thread finds its stats block at the resource's slot, which a
+        // later resource reuses, so the table only grows to the most
+        // resources alive at once; the id tells the slot's owners apart. The
+        // lock is taken only the first time a thread touches a given resource.
+        tracking_stats &
+        local()
+        {
+            struct entry
+            {
+                std::uint64_t   id    = 0;
+                tracking_stats *stats = nullptr;
+            };
+            thread_local std::vector<entry> slots;
+            if (m_slot < slots.size() && slots[m_slot].id == m_id)
+            {
+                return *slots[m_slot].stats;
+            }
+            if (m_slot >= slots.size())
+            {
+                slots.resize(m_slot + 1);
+            }
+            std::lock_guard lk(m_mtx);
+            auto           *stats = m_threads.emplace_back(std::make_unique<tracking_stats>()).get();
+            slots[m_slot]         = entry{m_id, stats};
+            return *stats;
+        }
+
+        size_t
+        prefix(size_t align) const
+        {
+            return m_track_lifetimes ? std::max(align, sizeof(std::int64_t)) : 0;
+        }
+
+        static std::int64_t
+        now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        void *
+        do_allocate(size_t bytes, size_t align) override
+        {
+            size_t pre = prefix(align);
+            char  *p   = static_cast<char *>(m_upstream->allocate(bytes + pre, align));
+            if (pre)
+            {
+                std::int64_t t = now();
+                std::memcpy(p + pre - sizeof t, &t, sizeof t);
+            }
+
+            auto &s = local();
+            tracking_stats::bump(s.allocs);
+            tracking_stats::bump(s.bytes_allocated, bytes);
+            tracking_stats::bump(s.size_histogram[tracking_stats::bucket(bytes)]);
+
+            std::int64_t live = m_live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            std::int64_t peak = m_peak.load(std::memory_order_relaxed);
+            while (live > peak && !m_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+            }
+            return p + pre;
+        }
+
+        void
+        do_deallocate(void *p, size_t bytes, size_t align) override
+        {
+            size_t pre = prefix(align);
+            char  *raw = static_cast<char *>(p) - pre;
+
+            auto &s = local();
+            tracking_stats::bump(s.deallocs);
+            tracking_stats::bump(s.bytes_freed, bytes);
+            if (pre)
+            {
+                std::int64_t t;
+                std::memcpy(&t, raw + pre - sizeof t, sizeof t);
+                tracking_stats::bump(s.lifetime_histogram[tracking_stats::bucket(now() - t)]);
+            }
+            m_live.fetch_sub(bytes, std::memory_order_relaxed);
+
+            m_upstream->deallocate(raw, bytes + pre, align);
+        }
+
+        bool
+        do_is_equal(const std::pmr::memory_resource &rhs) const noexcept override
+        {
+            return this == &rhs;
+        }
+
+        static void
+        report_all()
+        {
+            auto           &r = global();
+            std::lock_guard lk(r.mtx);
+            for (auto &&rep : r.retired)
+            {
+                rep.print(r.report_to);
+            }
+            for (auto *mr : r.live)
+            {
+                mr->report().print(r.report_to);
+            }
+        }
+
+      public:
+        explicit tracking_resource(std::string                tag,
+                                   std::pmr::memory_resource *upstream        = std::pmr::get_default_resource(),
+                                   bool                       track_lifetimes = true)
+            : m_tag(std::move(tag)), m_upstream(upstream), m_track_lifetimes(track_lifetimes)
+        {
+            auto           &r = global();
+            std::lock_guard lk(r.mtx);
+            r.live.push_back(this);
+            if (r.free_slots.empty())
+            {
+                m_slot = r.next_slot++;
+            }
+            else
+            {
+                m_slot = r.free_slots.back();
+                r.free_slots.pop_back();
+            }
+        }
+
+        tracking_resource(const tracking_resource &)            = delete;
+        tracking_resource &operator=(const tracking_resource &) = delete;
+
+        ~tracking_resource()
+        {
+            auto           &r = global();
+            std::lock_guard lk(r.mtx);
+            std::erase(r.live, this);
+            r.free_slots.push_back(m_slot);
+            if (r.report_to)
+            {
+                r.retired.push_back(report());
+            }
+        }
+
+        // Print every tracking_resource, living or dead, when the program exits.
+        static void
+        enable_report_at_exit(FILE *fp = stderr)
+        {
+            auto &r = global();
+            {
+                std::lock_guard lk(r.mtx);
+                if (std::exchange(r.report_to, fp) != nullptr)
+                {
+                    return;
+                }
+            }
+            std::atexit(report_all);
+        }
+
+        tracking_report
+        report() const
+        {
+            tracking_report rep;
+            rep.tag             = m_tag;
+            rep.peak_live_bytes = m_peak.load(std::memory_order_relaxed);
+            std::lock_guard lk(m_mtx);
+            for (auto &&s : m_threads)
+            {
+                rep.allocs += s->allocs.load(std::memory_order_relaxed);
+                rep.deallocs += s->deallocs.load(std::memory_order_relaxed);
+                rep.bytes_allocated += s->bytes_allocated.load(std::memory_order_relaxed);
+                rep.bytes_freed += s->bytes_freed.load(std::memory_order_relaxed);
+                for (int i = 0; i < tracking_stats::buckets; ++i)
+                {
+                    rep.size_histogram[i] += s->size_histogram[i].load(std::memory_order_relaxed);
+                    rep.lifetime_histogram[i] += s->lifetime_histogram[i].load(std::memory_order_relaxed);
+                }
+            }
+            return rep;
+        }
+    };
+
+    // A program would call tracking_resource::enable_report_at_exit() once,
+    // from main(); the test prints its own reports instead, so as not to
+    // turn it on for every other example in this file, and tries the exit
+    // report out in a child process.
+    void
+    test()
+    {
+        // Like ex11's helloworld, but nothing is printed on the hot path.
+        tracking_resource vmr("vector<int>");
+        {
+            std::pmr::vector<int> v(&vmr);
+            for (int i = 0; i < 100; ++i)
+            {
+                v.push_back(i);
+            }
+        }
+        auto rep = vmr.report();
+        assert(rep.allocs == 8 && rep.deallocs == 8 && rep.live_bytes() == 0);
+        assert(rep.peak_live_bytes == (128 + 64) * sizeof(int));
+        rep.print(stdout);
+
+        // Per-thread counters are summed when the report is taken.
+        tracking_resource lmr("list<int>", std::pmr::new_delete_resource(), false);
+        {
+            std::pmr::list<int>      lst(&lmr);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 4; ++t)
+            {
+                threads.emplace_back([&] {
+                    std::pmr::list<int> mine(&lmr);
+                    for (int i = 0; i < 1000; ++i)
+                    {
+                        mine.push_back(i);
+                    }
+                });
+            }
+            for (auto &&th : threads)
+            {
+                th.join();
+            }
+            lst.push_back(42);
+            rep = lmr.report();
+            assert(rep.allocs == 4001 && rep.live_bytes() == rep.bytes_allocated / 4001);
+            rep.print(stdout);
+        }
+
+        // A new resource in a dead one's slot doesn't inherit its stats.
+        {
+            auto first = std::make_unique<tracking_resource>("first", std::pmr::new_delete_resource(), false);
+            first->deallocate(first->allocate(16), 16);
+            first.reset();
+            tracking_resource second("second", std::pmr::new_delete_resource(), false);
+            second.deallocate(second.allocate(32), 32);
+            rep = second.report();
+            assert(rep.allocs == 1 && rep.bytes_allocated == 32);
+        }
+
+        // The exit report covers resources both dead and still alive.
+        int fds[2];
+        int rc = pipe(fds);
+        assert(rc == 0);
+        (void)rc;
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            close(fds[0]);
+            tracking_resource      alive("alive", std::pmr::new_delete_resource(), false);
+            std::pmr::vector<char> kept(200, &alive); // exit() doesn't unwind the stack
+            tracking_resource::enable_report_at_exit(fdopen(fds[1], "w"));
+            {
+                tracking_resource dead("dead", std::pmr::new_delete_resource(), false);
+                dead.deallocate(dead.allocate(100), 100);
+            }
+            exit(0);
+        }
+        close(fds[1]);
+        std::string out;
+        char        buf[256];
+        for (ssize_t n; (n = read(fds[0], buf, sizeof buf)) > 0;)
+        {
+            out.append(buf, n);
+        }
+        close(fds[0]);
+        int status;
+        waitpid(child, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        assert(out.find("\"dead\": 1 allocs, 1 frees, 100 bytes, 0 live") != out.npos);
+        assert(out.find("\"alive\": 1 allocs, 0 frees, 200 bytes, 200 live") != out.npos);
+    }
+} // namespace ex40
+
+// Per-level arenas for arbitrarily deep nesting
+
+namespace ex41
+{
+    // One memory resource per nesting level. Levels deeper than the chain
+    // all share its last resource, so running out of levels is never a trap
+    // the way ex32's TooShortAlloc is.
+    class arena_chain
+    {
+        std::vector<std::pmr::memory_resource *> m_levels;
+
+      public:
+        arena_chain(std::initializer_list<std::pmr::memory_resource *> levels) : m_levels(levels)
+        {
+            assert(!m_levels.empty());
+        }
+
+        std::pmr::memory_resource *
+        resource(unsigned depth) const
+        {
+            return m_levels[std::min<size_t>(depth, m_levels.size() - 1)];
+        }
+    };
+
+    // Like polymorphic_allocator, but it also remembers its depth. Whatever
+    // a container constructs inside itself is handed the next level down,
+    // through uses-allocator construction, so pairs and strings work too.
+    template <class T>
+    class level_allocator
+    {
+        const arena_chain *m_chain;
+        unsigned           m_depth;
+
+        template <class U>
+        friend class level_allocator;
+
+      public:
+        using value_type = T;
+
+        level_allocator(const arena_chain *chain, unsigned depth = 0) : m_chain(chain), m_depth(depth)
+        {
+        }
+
+        template <class U>
+        level_allocator(const level_allocator<U> &rhs) : m_chain(rhs.m_chain), m_depth(rhs.m_depth)
+        {
+        }
+
+        T *
+        allocate(size_t n)
+        {
+            return static_cast<T *>(resource()->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void
+        deallocate(T *p, size_t n)
+        {
+            resource()->deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        template <class U, class... Args>
+        void
+        construct(U *p, Args &&...args)
+        {
+            std::uninitialized_construct_using_allocator(p, level_allocator<U>(m_chain, m_depth + 1),
+                                                         std::forward<Args>(args)...);
+        }
+
+        std::pmr::memory_resource *
+        resource() const
+        {
+            return m_chain->resource(m_depth);
+        }
+
+        unsigned
+        depth() const
+        {
+            return m_depth;
+        }
+
+        template <class U>
+        bool
+        operator==(const level_allocator<U> &rhs) const
+        {
+            return m_chain == rhs.m_chain && m_depth == rhs.m_depth;
+        }
+    };
+
+    namespace nested
+    {
+        template <class T>
+        using vector = std::vector<T, level_allocator<T>>;
+
+        template <class K, class V>
+        using map = std::map<K, V, std::less<>, level_allocator<std::pair<const K, V>>>;
+
+        using string = std::basic_string<char, std::char_traits<char>, level_allocator<char>>;
+    } // namespace nested
+
+    using Document = nested::map<nested::string, nested::vector<nested::string>>;
+
+    void
+    test()
+    {
+        ex40::tracking_resource l0("level 0"), l1("level 1"), l2("level 2");
+        arena_chain             chain{&l0, &l1, &l2};
+
+        {
+            Document doc(&chain);
+            for (int i = 0; i < 10; ++i)
+            {
+                auto key = "a key that is too long for SSO " + std::to_string(i);
+                auto it  = doc.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first;
+                auto &v  = it->second;
+                v.emplace_back("a value that is also too long for SSO");
+            }
+            assert(doc.get_allocator().depth() == 0);
+            assert(doc.begin()->first.get_allocator().depth() == 1);
+            assert(doc.begin()->second.get_allocator().depth() == 1);
+            assert(doc.begin()->second[0].get_allocator().depth() == 2);
+        }
+        // Level 0: the map nodes. Level 1: each key and vector buffer.
+        // Level 2: each string in a vector.
+        assert(l0.report().allocs == 10);
+        assert(l1.report().allocs == 20);
+        assert(l2.report().allocs == 10);
+
+        // Five levels of nesting over a two-level chain.
+        arena_chain short_chain{&l0, &l1};
+        using V5 = nested::vector<nested::vector<nested::vector<nested::vector<nested::vector<int>>>>>;
+        V5 v5(&short_chain);
+        v5.emplace_back().emplace_back().emplace_back().emplace_back().push_back(42);
+        assert(v5[0][0][0][0].get_allocator().depth() == 4);
+        assert(v5[0][0][0][0].get_allocator().resource() == &l1);
+    }
+
+    template <class Map>
+    void
+    build_document(Map &doc, int keys, int values)
+    {
+        char buf[64];
+        for (int i = 0; i < keys; ++i)
+        {
+            // Construct the key in place, so that it is built by the map's
+            // allocator rather than copied over from a temporary.
+            snprintf(buf, sizeof buf, "document key number %08d", i);
+            auto &v = doc.emplace(std::piecewise_construct, std::forward_as_tuple(buf), std::tuple<>()).first->second;
+            for (int j = 0; j < values; ++j)
+            {
+                snprintf(buf, sizeof buf, "value %08d of key %08d, padded", j, i);
+                v.emplace_back(buf);
+            }
+        }
+    }
+
+    void
+    bench()
+    {
+        constexpr int keys = 20000, values = 8, rounds = 5;
+        using clock        = std::chrono::steady_clock;
+
+        auto t0 = clock::now();
+        for (int r = 0; r < rounds; ++r)
+        {
+            std::map<std::string, std::vector<std::string>, std::less<>> doc;
+            build_document(doc, keys, values);
+        }
+        auto t1 = clock::now();
+        for (int r = 0; r < rounds; ++r)
+        {
+            std::pmr::monotonic_buffer_resource l0, l1, l2;
+            arena_chain                         chain{&l0, &l1, &l2};
+            Document                            doc(&chain);
+            build_document(doc, keys, values);
+        }
+        auto t2 = clock::now();
+
+        using ms = std::chrono::duration<double, std::milli>;
+        printf("ex41: build+teardown of %d keys x %d strings: malloc %.1f ms, scoped arenas %.1f ms\n", keys, values,
+               ms(t1 - t0).count() / rounds, ms(t2 - t1).count() / rounds);
+    }
+} // namespace ex41
+
+// Skipping value-initialization on resize
+
+namespace ex42
+{
+    // ex30's my_allocator, generalized: wraps any allocator, including
+    // polymorphic_allocator and so any memory_resource, and turns the
+    // value-initialization performed by resize(n) into default-initialization.
+    template <class A>
+    class default_init_allocator : public A
+    {
+        using Traits = std::allocator_traits<A>;
+
+      public:
+        template <class U>
+        struct rebind
+        {
+            using other = default_init_allocator<typename Traits::template rebind_alloc<U>>;
+        };
+
+        using A::A;
+
+        default_init_allocator() = default;
+
+        default_init_allocator(const A &a) : A(a)
+        {
+        }
+
+        template <class B>
+        default_init_allocator(const default_init_allocator<B> &rhs) : A(static_cast<const B &>(rhs))
+        {
+        }
+
+        template <class U>
+        void
+        construct(U *p) noexcept(std::is_nothrow_default_constructible_v<U>)
+        {
+            ::new (static_cast<void *>(p)) U;
+        }
+
+        template <class U, class... Args>
+        void
+        construct(U *p, Args &&...args)
+        {
+            Traits::construct(static_cast<A &>(*this), p, std::forward<Args>(args)...);
+        }
+    };
+
+    // Buffers that are about to be overwritten by read(), memcpy() and the like.
+    using byte_buffer = std::vector<char, default_init_allocator<std::allocator<char>>>;
+
+    namespace pmr
+    {
+        using byte_buffer = std::vector<char, default_init_allocator<std::pmr::polymorphic_allocator<char>>>;
+    } // namespace pmr
+
+    void
+    test()
+    {
+        alignas(16) char raw[256];
+        std::memset(raw, 0xAB, sizeof raw);
+        std::pmr::monotonic_buffer_resource mr(raw, sizeof raw, std::pmr::null_memory_resource());
+
+        pmr::byte_buffer buf(&mr);
+        buf.resize(64);
+        // resize() didn't write a single byte...
+        assert(buf.data() >= raw && buf.data() + 64 <= raw + sizeof raw);
+        assert(std::all_of(raw, raw + sizeof raw, [](char c) { return c == char(0xAB); }));
+        // ...but explicit values are still honored.
+        buf.resize(96, 'x');
+        assert(buf[64] == 'x' && buf[95] == 'x');
+
+        std::vector<std::string, default_init_allocator<std::allocator<std::string>>> v;
+        v.resize(3);
+        v.emplace_back("hello");
+        assert(v[0].empty() && v[3] == "hello");
+    }
+
+    long
+    minor_faults()
+    {
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return ru.ru_minflt;
+    }
+
+    template <class Buffer>
+    void
+    bench_one(const char *name, size_t bytes)
+    {
+        using clock = std::chrono::steady_clock;
+        using ms    = std::chrono::duration<double, std::milli>;
+
+        Buffer b;
+        long   f0 = minor_faults();
+        auto   t0 = clock::now();
+        b.resize(bytes);
+        long f1 = minor_faults();
+        auto t1 = clock::now();
+        std::memset(b.data(), 'x', bytes); // stands in for read(fd, b.data(), bytes)
+        long f2 = minor_faults();
+        auto t2 = clock::now();
+        printf("ex42: %-22s resize %6.1f ms %7ld faults, fill %6.1f ms %7ld faults\n", name, ms(t1 - t0).count(),
+               f1 - f0, ms(t2 - t1).count(), f2 - f1);
+    }
+
+    void
+    bench()
+    {
+        constexpr size_t bytes = size_t(64) << 20;
+        bench_one<std::vector<char>>("std::vector<char>", bytes);
+        bench_one<byte_buffer>("byte_buffer", bytes);
+    }
+} // namespace ex42
+
+// Bundling a container with its own arena, safely
+
+namespace ex43
+{
+    // A pmr container together with the arena it allocates from. By default
+    // the arena is an inline buffer that spills over to the default resource;
+    // alternatively, several bundles may share one external arena.
+    //
+    // Unlike ex21's Widget, moving and swapping are always defined: when both
+    // sides allocate from the same arena we just exchange pointers, and
+    // otherwise the elements are moved into the arena that owns them.
+    //
+    // A monotonic arena never reuses what is freed into it, so a bundle with
+    // an arena of its own rewinds it whenever its whole contents are being
+    // replaced; otherwise every cross-arena swap or assignment would leave
+    // the old storage stranded there.
+    //
+    // A cross-arena swap first copies both sides out to the default resource
+    // (or moves them, for move-only elements), so if that throws, both
+    // bundles are left as they were. Moving the elements back into the
+    // rewound arenas can only throw bad_alloc from upstream, or a throwing
+    // move constructor; then both bundles are valid but may have lost their
+    // elements (the basic guarantee).
+    template <class Container, size_t InlineBytes = 256>
+    class arena_bundle
+    {
+        alignas(std::max_align_t) char      m_buffer[InlineBytes];
+        std::pmr::monotonic_buffer_resource m_inline{m_buffer, InlineBytes};
+        std::pmr::memory_resource          *m_arena = &m_inline;
+        Container                           m_container{m_arena};
+
+        // A copy of c outside every bundle's arena.
+        static Container
+        park(Container &c)
+        {
+            if constexpr (std::is_copy_constructible_v<typename Container::value_type>)
+            {
+                return Container(c, std::pmr::get_default_resource());
+            }
+            else
+            {
+                return Container(std::move(c), std::pmr::get_default_resource());
+            }
+        }
+
+        // Replaces the contents with src's, which must not live in our arena.
+        template <class Source>
+        void
+        replace(Source &&src)
+        {
+            if (shares_arena())
+            {
+                m_container = std::forward<Source>(src);
+                return;
+            }
+            m_container.~Container();
+            m_inline.release();
+            try
+            {
+                ::new (&m_container) Container(std::forward<Source>(src), m_arena);
+            }
+            catch (...)
+            {
+                ::new (&m_container) Container(m_arena);
+                throw;
+            }
+        }
+
+      public:
+        arena_bundle() = default;
+
+        explicit arena_bundle(std::pmr::memory_resource *shared) : m_arena(shared), m_container(m_arena)
+        {
+        }
+
+        arena_bundle(const arena_bundle &rhs)
+            : m_arena(rhs.shares_arena() ? rhs.m_arena : &m_inline), m_container(rhs.m_container, m_arena)
+        {
+        }
+
+        // A bundle that owns its arena can't hand it over, so the new bundle
+        // gets an arena of its own and the elements are moved into it.
+        arena_bundle(arena_bundle &&rhs)
+            : m_arena(rhs.shares_arena() ? rhs.m_arena : &m_inline), m_container(std::move(rhs.m_container), m_arena)
+        {
+        }
+
+        // pmr containers never propagate their allocator on assignment; they
+        // steal from an equal allocator and move element-wise otherwise.
+        arena_bundle &
+        operator=(const arena_bundle &rhs)
+        {
+            if (m_container.get_allocator() == rhs.m_container.get_allocator())
+            {
+                m_container = rhs.m_container;
+            }
+            else
+            {
+                replace(rhs.m_container);
+            }
+            return *this;
+        }
+
+        arena_bundle &
+        operator=(arena_bundle &&rhs)
+        {
+            if (m_container.get_allocator() == rhs.m_container.get_allocator())
+            {
+                m_container = std::move(rhs.m_container);
+            }
+            else
+            {
+                replace(std::move(rhs.m_container));
+            }
+            return *this;
+        }
+
+        void
+        swap(arena_bundle &rhs)
+        {
+            if (m_container.get_allocator() == rhs.m_container.get_allocator())
+            {
+                using std::swap;
+                swap(m_container, rhs.m_container);
+            }
+            else
+            {
+                // Park both sides outside both arenas while they're rewound.
+                Container mine   = park(m_container);
+                Container theirs = park(rhs.m_container);
+                replace(std::move(theirs));
+                rhs.replace(std::move(mine));
+            }
+        }
+
+        friend void
+        swap(arena_bundle &a, arena_bundle &b)
+        {
+            a.swap(b);
+        }
+
+        bool
+        shares_arena() const
+        {
+            return m_arena != &m_inline;
+        }
+
+        bool
+        in_inline_buffer(const void *p) const
+        {
+            return std::less_equal<>()(m_buffer, p) && std::less<>()(p, m_buffer + InlineBytes);
+        }
+
+        Container &
+        operator*()
+        {
+            return m_container;
+        }
+
+        const Container &
+        operator*() const
+        {
+            return m_container;
+        }
+
+        Container *
+        operator->()
+        {
+            return &m_container;
+        }
+
+        const Container *
+        operator->() const
+        {
+            return &m_container;
+        }
+    };
+
+    // Copying it throws once copies_left counts down to zero.
+    struct fragile
+    {
+        static inline int copies_left = -1;
+
+        int value;
+
+        fragile(int v) : value(v)
+        {
+        }
+
+        fragile(const fragile &rhs) : value(rhs.value)
+        {
+            if (copies_left >= 0 && copies_left-- == 0)
+            {
+                throw std::runtime_error("fragile copy");
+            }
+        }
+
+        fragile(fragile &&) noexcept            = default;
+        fragile &operator=(const fragile &)     = default;
+        fragile &operator=(fragile &&) noexcept = default;
+    };
+
+    class Widget
+    {
+      private:
+        arena_bundle<std::pmr::vector<int>, 1024> v;
+        arena_bundle<std::pmr::list<int>, 1024>   lst;
+
+      public:
+        static void
+        swap_elems(Widget &a, Widget &b)
+        {
+            swap(a.v, b.v);
+            swap(a.lst, b.lst);
+        }
+
+        void
+        add(int x)
+        {
+            v->push_back(x);
+            lst->push_back(x);
+        }
+
+        int
+        front() const
+        {
+            assert(v->front() == lst->front());
+            return v->front();
+        }
+
+        bool
+        uses_own_buffer() const
+        {
+            return v.in_inline_buffer(v->data()) && lst.in_inline_buffer(&lst->front());
+        }
+    };
+
+    void
+    test()
+    {
+        Widget w1, w2;
+        w1.add(1);
+        w2.add(2);
+        Widget::swap_elems(w1, w2);
+        assert(w1.front() == 2 && w2.front() == 1);
+        assert(w1.uses_own_buffer() && w2.uses_own_buffer());
+
+        // Moving out of a bundle never leaves the new one pointing into the old buffer.
+        using Bundle = arena_bundle<std::pmr::vector<int>>;
+        auto b1      = std::make_unique<Bundle>();
+        (*b1)->assign({1, 2, 3});
+        Bundle b2 = std::move(*b1);
+        b1.reset();
+        assert(b2.in_inline_buffer(b2->data()) && b2->back() == 3);
+
+        // Bigger than the inline buffer: the arena spills upstream, and it still works.
+        Bundle big;
+        big->resize(1000, 7);
+        swap(big, b2);
+        assert(big->size() == 3 && b2->size() == 1000 && b2->back() == 7);
+
+        // Cross-arena swaps and assignments rewind an arena of the bundle's
+        // own, so they don't use up the inline buffer.
+        Bundle a, b;
+        a->assign({1, 2, 3});
+        b->assign({4, 5});
+        for (int i = 0; i < 100; ++i)
+        {
+            swap(a, b);
+            Bundle c;
+            c->assign({6, 7, 8, 9});
+            b = c;
+            b = std::move(c);
+        }
+        assert(a.in_inline_buffer(a->data()) && b.in_inline_buffer(b->data()));
+        assert(*a == *b && b->size() == 4 && b->front() == 6);
+
+        // A swap that throws while copying leaves both bundles as they were.
+        arena_bundle<std::pmr::vector<fragile>> f1, f2;
+        f1->assign({1, 2, 3});
+        f2->assign({4, 5});
+        for (int n = 0; n < 5; ++n)
+        {
+            fragile::copies_left = n;
+            try
+            {
+                swap(f1, f2);
+                assert(false);
+            }
+            catch (const std::runtime_error &)
+            {
+            }
+            assert(f1->size() == 3 && f1->back().value == 3 && f2->size() == 2 && f2->back().value == 5);
+        }
+        fragile::copies_left = -1;
+        swap(f1, f2);
+        assert(f1->size() == 2 && f1->back().value == 5 && f2->size() == 3 && f2->back().value == 3);
+
+        // Bundles that share an arena swap by exchanging pointers.
+        std::pmr::monotonic_buffer_resource shared;
+        Bundle                              s1(&shared), s2(&shared);
+        s1->push_back(1);
+        s2->push_back(2);
+        const int *p1 = s1->data();
+        swap(s1, s2);
+        assert(s2->data() == p1 && s1->front() == 2);
+        Bundle s3 = std::move(s2);
+        assert(s3->data() == p1 && s3.shares_arena());
+    }
+} // namespace ex43
+
+// A single-object box that reuses its storage
+
+namespace ex44
+{
+    // ex27's uniqueish, except that emplace() destroys and reconstructs in
+    // place instead of going back to the allocator, and that with Inline the
+    // object lives inside the box itself. The allocator (which may be a
+    // stateful pool allocator) is still used to construct and destroy it.
+    template <class T, class A = std::allocator<T>, bool Inline = false>
+    class uniqueish
+    {
+      private:
+        using Traits   = std::allocator_traits<A>;
+        using FancyPtr = typename Traits::pointer;
+
+        struct heap_storage
+        {
+            FancyPtr ptr = nullptr;
+        };
+
+        struct inline_storage
+        {
+            alignas(T) unsigned char bytes[sizeof(T)];
+        };
+
+        [[no_unique_address]] A                                  m_allocator;
+        std::conditional_t<Inline, inline_storage, heap_storage> m_storage;
+        bool                                                     m_engaged = false;
+
+        T *
+        raw()
+        {
+            if constexpr (Inline)
+            {
+                return std::launder(reinterpret_cast<T *>(m_storage.bytes));
+            }
+            else
+            {
+                return std::to_address(m_storage.ptr);
+            }
+        }
+
+        const T *
+        raw() const
+        {
+            return const_cast<uniqueish *>(this)->raw();
+        }
+
+        bool
+        can_adopt(const uniqueish &rhs) const
+        {
+            return !Inline && (Traits::propagate_on_container_move_assignment::value || m_allocator == rhs.m_allocator);
+        }
+
+      public:
+        using allocator_type = A;
+
+        uniqueish(A a = {}) : m_allocator(a)
+        {
+            this->emplace();
+        }
+
+        template <class... Args>
+        void
+        emplace(Args &&...args)
+        {
+            clear();
+            if constexpr (!Inline)
+            {
+                if (!m_storage.ptr)
+                {
+                    m_storage.ptr = Traits::allocate(m_allocator, 1);
+                }
+            }
+            // If this throws, we are left empty but keep our storage.
+            Traits::construct(m_allocator, raw(), std::forward<Args>(args)...);
+            m_engaged = true;
+        }
+
+        ~uniqueish()
+        {
+            reset();
+        }
+
+        // Destroy the value, but hang on to its storage for the next emplace().
+        void
+        clear() noexcept
+        {
+            if (m_engaged)
+            {
+                Traits::destroy(m_allocator, raw());
+                m_engaged = false;
+            }
+        }
+
+        // Destroy the value and give its storage back to the allocator.
+        void
+        reset() noexcept
+        {
+            clear();
+            if constexpr (!Inline)
+            {
+                if (m_storage.ptr)
+                {
+                    Traits::deallocate(m_allocator, m_storage.ptr, 1);
+                    m_storage.ptr = nullptr;
+                }
+            }
+        }
+
+        bool
+        has_value() const
+        {
+            return m_engaged;
+        }
+
+        T &
+        value()
+        {
+            return *raw();
+        }
+
+        const T &
+        value() const
+        {
+            return *raw();
+        }
+
+        uniqueish(uniqueish &&rhs) : m_allocator(rhs.m_allocator)
+        {
+            if constexpr (Inline)
+            {
+                if (rhs.m_engaged)
+                {
+                    this->emplace(std::move(rhs.value()));
+                    rhs.clear();
+                }
+            }
+            else
+            {
+                m_storage.ptr = std::exchange(rhs.m_storage.ptr, nullptr);
+                m_engaged     = std::exchange(rhs.m_engaged, false);
+            }
+        }
+
+        uniqueish &
+        operator=(uniqueish &&rhs)
+        {
+            if (this == &rhs)
+            {
+                return *this;
+            }
+            if (can_adopt(rhs))
+            {
+                this->reset(); // using the old allocator
+                if constexpr (Traits::propagate_on_container_move_assignment::value)
+                {
+                    this->m_allocator = rhs.m_allocator;
+                }
+                if constexpr (!Inline)
+                {
+                    this->m_storage.ptr = std::exchange(rhs.m_storage.ptr, nullptr);
+                }
+                this->m_engaged = std::exchange(rhs.m_engaged, false);
+            }
+            else if (rhs.m_engaged)
+            {
+                // Reuses our storage, if we have any.
+                this->emplace(std::move(rhs.value()));
+                rhs.clear();
+            }
+            else
+            {
+                this->clear();
+            }
+            return *this;
+        }
+
+        void
+        swap(uniqueish &rhs)
+        {
+            constexpr bool pocs = Traits::propagate_on_container_swap::value;
+            using std::swap;
+
+            if (!Inline && (pocs || m_allocator == rhs.m_allocator))
+            {
+                if constexpr (pocs)
+                {
+                    swap(this->m_allocator, rhs.m_allocator);
+                }
+                if constexpr (!Inline)
+                {
+                    swap(this->m_storage.ptr, rhs.m_storage.ptr);
+                }
+                swap(this->m_engaged, rhs.m_engaged);
+            }
+            else
+            {
+                auto temp = std::move(*this);
+                *this     = std::move(rhs); // might throw
+                rhs       = std::move(temp); // might throw
+            }
+        }
+    };
+
+    struct Point
+    {
+        double x = 0, y = 0, z = 0;
+    };
+
+    void
+    test()
+    {
+        ex40::tracking_resource                tr("uniqueish", std::pmr::new_delete_resource(), false);
+        std::pmr::unsynchronized_pool_resource pool(&tr);
+        using Alloc = std::pmr::polymorphic_allocator<std::pmr::string>;
+
+        uniqueish<std::pmr::string, Alloc> a(&pool);
+        a.emplace("a string long enough to need its own allocation");
+        const void *storage = &a.value();
+        a.emplace("another string that is long enough to allocate");
+        assert(&a.value() == storage);
+        assert(a.value().get_allocator().resource() == &pool); // uses-allocator construction
+
+        uniqueish<std::pmr::string, Alloc> b(&pool);
+        b = std::move(a); // same pool: adopts a's storage
+        assert(&b.value() == storage && !a.has_value());
+        a.emplace("x");
+        a.swap(b);
+        assert(b.value() == "x" && a.value().size() > 40);
+
+        uniqueish<Point, std::allocator<Point>, true> in;
+        in.emplace(Point{1, 2, 3});
+        uniqueish<Point, std::allocator<Point>, true> in2 = std::move(in);
+        assert(in2.value().z == 3 && !in.has_value());
+        static_assert(sizeof(in) == sizeof(Point) + alignof(Point));
+    }
+
+    template <class Box>
+    std::uint64_t
+    replace_many(Box &box, ex40::tracking_resource &tr, int n)
+    {
+        box.emplace(Point{0, 0, 0}); // warm-up
+        auto before = tr.report().allocs;
+        for (int i = 0; i < n; ++i)
+        {
+            box.emplace(Point{double(i), 1, 2});
+        }
+        return tr.report().allocs - before;
+    }
+
+    void
+    bench()
+    {
+        constexpr int n = 1000000;
+        using Alloc     = std::pmr::polymorphic_allocator<Point>;
+        using clock     = std::chrono::steady_clock;
+        using ms        = std::chrono::duration<double, std::milli>;
+
+        ex40::tracking_resource       tr("uniqueish bench", std::pmr::new_delete_resource(), false);
+        ex24::uniqueish<Point, Alloc> old_box(&tr);
+        uniqueish<Point, Alloc>       heap_box(&tr);
+        uniqueish<Point, Alloc, true> inline_box(&tr);
+
+        auto t0       = clock::now();
+        auto old_n    = replace_many(old_box, tr, n);
+        auto t1       = clock::now();
+        auto heap_n   = replace_many(heap_box, tr, n);
+        auto t2       = clock::now();
+        auto inline_n = replace_many(inline_box, tr, n);
+        auto t3       = clock::now();
+        assert(old_n == n && heap_n == 0 && inline_n == 0);
+
+        printf("ex44: %d replacements: ex24 %.1f ms (%llu allocs), reuse %.1f ms (%llu), inline %.1f ms (%llu)\n", n,
+               ms(t1 - t0).count(), (unsigned long long)old_n, ms(t2 - t1).count(), (unsigned long long)heap_n,
+               ms(t3 - t2).count(), (unsigned long long)inline_n);
+    }
+} // namespace ex44
+
+// A huge-page upstream for large arenas
+
+namespace ex45
+{
+    struct huge_page_options
+    {
+        bool   use_hugetlb         = true;      // try MAP_HUGETLB before falling back
+        bool   prefault            = false;     // populate page tables up front
+        size_t keep_resident_bytes = 64 << 20;  // freed mappings past this get MADV_DONTNEED
+        size_t keep_mapped_bytes   = 256 << 20; // freed mappings past this get munmap'ed
+    };
+
+    struct huge_page_stats
+    {
+        size_t hugetlb_maps = 0; // explicit huge pages from the hugetlbfs pool
+        size_t thp_maps     = 0; // normal mappings advised MADV_HUGEPAGE
+        size_t reused       = 0; // served from previously freed mappings
+        size_t dontneed     = 0; // mappings whose pages went back to the OS
+        size_t unmapped     = 0;
+    };
+
+    // Meant to sit under a monotonic_buffer_resource or pool resource, not to
+    // serve small objects: every request is rounded up to whole huge pages.
+    class huge_page_resource : public std::pmr::memory_resource
+    {
+        static constexpr size_t huge_page = 2 << 20;
+
+        struct mapping
+        {
+            char  *addr;
+            size_t size;
+            bool   resident;
+        };
+
+        huge_page_options    m_options;
+        huge_page_stats      m_stats;
+        std::vector<mapping> m_free; // freed mappings kept for reuse
+        size_t               m_free_bytes     = 0;
+        size_t               m_resident_bytes = 0;
+
+        static size_t
+        round_up(size_t n)
+        {
+            return n + (-n % huge_page);
+        }
+
+        char *
+        map_new(size_t size)
+        {
+            if (m_options.use_hugetlb)
+            {
+                int   flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (m_options.prefault ? MAP_POPULATE : 0);
+                void *p     = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+                if (p != MAP_FAILED)
+                {
+                    ++m_stats.hugetlb_maps;
+                    return static_cast<char *>(p);
+                }
+            }
+
+            // Over-map so the region can be trimmed to a 2 MiB boundary,
+            // which transparent huge pages need.
+            void *p = mmap(nullptr, size + huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            char *raw  = static_cast<char *>(p);
+            char *addr = raw + (-reinterpret_cast<std::uintptr_t>(raw) % huge_page);
+            if (addr != raw)
+            {
+                munmap(raw, addr - raw);
+            }
+            munmap(addr + size, raw + huge_page - addr);
+            madvise(addr, size, MADV_HUGEPAGE); // just a hint; may fail harmlessly
+            ++m_stats.thp_maps;
+            if (m_options.prefault)
+            {
+                prefault(addr, size);
+            }
+            return addr;
+        }
+
+        static void
+        prefault(char *addr, size_t size)
+        {
+#ifdef MADV_POPULATE_WRITE
+            if (madvise(addr, size, MADV_POPULATE_WRITE) == 0)
+            {
+                return;
+            }
+#endif
+            for (size_t i = 0; i < size; i += 4096)
+            {
+                addr[i] = 0;
+            }
+        }
+
+        // Bring the cache of freed mappings back under the thresholds,
+        // oldest first.
+        void
+        trim()
+        {
+            for (auto &&m : m_free)
+            {
+                if (m_resident_bytes <= m_options.keep_resident_bytes)
+                {
+                    break;
+                }
+                if (m.resident)
+                {
+                    madvise(m.addr, m.size, MADV_DONTNEED);
+                    m.resident = false;
+                    m_resident_bytes -= m.size;
+                    ++m_stats.dontneed;
+                }
+            }
+            while (m_free_bytes > m_options.keep_mapped_bytes)
+            {
+                mapping m = m_free.front();
+                m_free.erase(m_free.begin());
+                munmap(m.addr, m.size);
+                m_free_bytes -= m.size;
+                m_resident_bytes -= m.resident ? m.size : 0;
+                ++m_stats.unmapped;
+            }
+        }
+
+        void *
+        do_allocate(size_t bytes, size_t align) override
+        {
+            if (align > huge_page)
+            {
+                throw std::bad_alloc();
+            }
+            size_t size = round_up(std::max<size_t>(bytes, 1));
+            for (auto it = m_free.begin(); it != m_free.end(); ++it)
+            {
+                if (it->size == size)
+                {
+                    mapping m = *it;
+                    m_free.erase(it);
+                    m_free_bytes -= size;
+                    m_resident_bytes -= m.resident ? size : 0;
+                    ++m_stats.reused;
+                    if (!m.resident && m_options.prefault)
+                    {
+                        prefault(m.addr, size);
+                    }
+                    return m.addr;
+                }
+            }
+            return map_new(size);
+        }
+
+        void
+        do_deallocate(void *p, size_t bytes, size_t) override
+        {
+            size_t size = round_up(std::max<size_t>(bytes, 1));
+            m_free.push_back(mapping{static_cast<char *>(p), size, true});
+            m_free_bytes += size;
+            m_resident_bytes += size;
+            trim();
+        }
+
+        bool
+        do_is_equal(const std::pmr::memory_resource &rhs) const noexcept override
+        {
+            return this == &rhs;
+        }
+
+      public:
+        explicit huge_page_resource(huge_page_options options = {}) : m_options(options)
+        {
+        }
+
+        huge_page_resource(const huge_page_resource &)            = delete;
+        huge_page_resource &operator=(const huge_page_resource &) = delete;
+
+        ~huge_page_resource()
+        {
+            for (auto &&m : m_free)
+            {
+                munmap(m.addr, m.size);
+            }
+        }
+
+        const huge_page_stats &
+        stats() const
+        {
+            return m_stats;
+        }
+    };
+
+    void
+    test()
+    {
+        huge_page_resource mr({.keep_resident_bytes = 4 << 20, .keep_mapped_bytes = 8 << 20});
+
+        void *p = mr.allocate(3 << 20);
+        assert(reinterpret_cast<std::uintptr_t>(p) % (2 << 20) == 0);
+        std::memset(p, 1, 3 << 20);
+        mr.deallocate(p, 3 << 20);
+
+        // The freed 4 MiB mapping is reused as is...
+        void *q = mr.allocate(4 << 20);
+        assert(q == p && mr.stats().reused == 1);
+
+        // ...and freed mappings past the thresholds go back to the OS.
+        void *r = mr.allocate(4 << 20);
+        void *s = mr.allocate(4 << 20);
+        mr.deallocate(q, 4 << 20);
+        mr.deallocate(r, 4 << 20);
+        mr.deallocate(s, 4 << 20);
+        assert(mr.stats().dontneed == 2 && mr.stats().unmapped == 1);
+        assert(mr.stats().hugetlb_maps + mr.stats().thp_maps == 3);
+
+        // As an upstream for an arena.
+        std::pmr::monotonic_buffer_resource arena(&mr);
+        std::pmr::vector<int>               v({1, 2, 3}, &arena);
+        assert(v[2] == 3);
+    }
+
+    // Counts data-TLB read misses for this thread; returns -1 if the kernel
+    // won't let us (no PMU in a VM, perf_event_paranoid, seccomp...).
+    class dtlb_counter
+    {
+        int m_fd;
+
+      public:
+        dtlb_counter()
+        {
+            perf_event_attr attr{};
+            attr.type   = PERF_TYPE_HW_CACHE;
+            attr.size   = sizeof attr;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled       = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            m_fd                = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (m_fd != -1)
+            {
+                ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+
+        dtlb_counter(const dtlb_counter &)            = delete;
+        dtlb_counter &operator=(const dtlb_counter &) = delete;
+
+        ~dtlb_counter()
+        {
+            if (m_fd != -1)
+            {
+                close(m_fd);
+            }
+        }
+
+        long long
+        read() const
+        {
+            long long count = -1;
+            if (m_fd == -1 || ::read(m_fd, &count, sizeof count) != sizeof count)
+            {
+                return -1;
+            }
+            return count;
+        }
+    };
+
+    void
+    bench_one(const char *name, std::pmr::memory_resource *upstream)
+    {
+        constexpr int n = 1 << 20;
+        using clock     = std::chrono::steady_clock;
+        using ms        = std::chrono::duration<double, std::milli>;
+
+        std::pmr::monotonic_buffer_resource                   arena(upstream);
+        std::pmr::unordered_map<std::uint64_t, std::uint64_t> m(&arena);
+        for (std::uint64_t i = 0; i < n; ++i)
+        {
+            m.emplace(i * 0x9E3779B97F4A7C15, i);
+        }
+
+        std::uint64_t sum = 0, x = 1;
+        dtlb_counter  misses;
+        auto          t0 = clock::now();
+        for (int i = 0; i < 4 * n; ++i)
+        {
+            x = x * 6364136223846793005 + 1442695040888963407;
+            sum += m.find((x >> 44) * 0x9E3779B97F4A7C15)->second;
+        }
+        auto      t1    = clock::now();
+        long long count = misses.read();
+        if (count >= 0)
+        {
+            printf("ex45: %-10s %d lookups: %.1f ms, %lld dTLB misses (%llu)\n", name, 4 * n, ms(t1 - t0).count(),
+                   count, (unsigned long long)sum);
+        }
+        else
+        {
+            printf("ex45: %-10s %d lookups: %.1f ms, dTLB misses unavailable (%llu)\n", name, 4 * n,
+                   ms(t1 - t0).count(), (unsigned long long)sum);
+        }
+    }
+
+    void
+    bench()
+    {
+        huge_page_resource huge({.prefault = true});
+        bench_one("malloc", std::pmr::new_delete_resource());
+        bench_one("huge pages", &huge);
+    }
+} // namespace ex45
+
+// Replacing global operator new
+
+namespace ex46
+{
+    // Meson's pool_new option links common/pool_new.cpp in and defines
+    // POOL_NEW. Without it there is nothing to test, and bench() measures the
+    // system malloc, which is the other half of the comparison.
+
+#ifdef POOL_NEW
+    // How far the global counters move while f runs on a thread of its own.
+    template <class F>
+    pool_new::stats
+    counted(F f)
+    {
+        pool_new::stats before = pool_new::snapshot();
+        std::thread(f).join();
+        pool_new::stats after = pool_new::snapshot();
+        return {after.allocations - before.allocations,
+                after.deallocations - before.deallocations,
+                after.bytes_requested - before.bytes_requested,
+                after.large - before.large,
+                after.refills - before.refills,
+                after.slab_bytes - before.slab_bytes};
+    }
+#endif
+
+    void
+    test()
+    {
+#ifdef POOL_NEW
+        constexpr int n = 1000;
+
+        // A thread that only frees what another allocated.
+        std::vector<int *> ints;
+        for (int i = 0; i < n; ++i)
+        {
+            ints.push_back(new int(i));
+        }
+        pool_new::stats s = counted([&] {
+            for (int *p : ints)
+            {
+                delete p;
+            }
+        });
+        assert(s.deallocations >= n);
+
+        // Frees from a thread_local destroyed after the pool's own per-thread
+        // teardown, which (being constructed later) runs first.
+        s = counted([] {
+            thread_local std::vector<std::unique_ptr<int>> late;
+            for (int i = 0; i < n; ++i)
+            {
+                late.push_back(std::make_unique<int>(i));
+            }
+        });
+        assert(s.allocations >= n);
+        assert(s.deallocations == s.allocations);
+
+        // Sizes that would wrap around once the block header is added.
+        for (std::size_t k : {std::size_t(1), std::size_t(8), std::size_t(100)})
+        {
+            std::size_t huge  = SIZE_MAX - k;
+            int         threw = 0;
+            try
+            {
+                ::operator delete(::operator new(huge));
+            }
+            catch (const std::bad_alloc &)
+            {
+                ++threw;
+            }
+            try
+            {
+                ::operator delete(::operator new(huge, std::align_val_t(64)), std::align_val_t(64));
+            }
+            catch (const std::bad_alloc &)
+            {
+                ++threw;
+            }
+            assert(threw == 2);
+            (void)threw;
+            assert(::operator new(huge, std::nothrow) == nullptr);
+            assert(::operator new(huge, std::align_val_t(64), std::nothrow) == nullptr);
+            assert(::operator new[](huge, std::nothrow) == nullptr);
+        }
+
+        // Snapshots taken while another thread is busy allocating.
+        std::atomic<bool> done{false};
+        std::thread       worker([&] {
+            while (!done.load(std::memory_order_relaxed))
+            {
+                std::vector<std::string> v(64, std::string(40, 'x'));
+            }
+        });
+        std::uint64_t last = 0;
+        for (int i = 0; i < 100; ++i)
+        {
+            pool_new::stats now = pool_new::snapshot();
+            assert(now.allocations >= last && now.deallocations <= now.allocations);
+            last = now.allocations;
+            std::this_thread::yield();
+        }
+        done = true;
+        worker.join();
+#endif
+    }
+
+    void
+    bench()
+    {
+        constexpr int threads = 4, keys = 50000, rounds = 5;
+        using clock           = std::chrono::steady_clock;
+        using ms              = std::chrono::duration<double, std::milli>;
+
+        auto work = [] {
+            for (int r = 0; r < rounds; ++r)
+            {
+                std::unordered_map<int, std::string> m;
+                for (int i = 0; i < keys; ++i)
+                {
+                    m.emplace(i, std::string(20 + i % 40, 'x'));
+                }
+            }
+        };
+
+        auto                     t0 = clock::now();
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t)
+        {
+            pool.emplace_back(work);
+        }
+        for (std::thread &t : pool)
+        {
+            t.join();
+        }
+        auto t1 = clock::now();
+
+#ifdef POOL_NEW
+        const char *allocator = "pool_new";
+#else
+        const char *allocator = "malloc";
+#endif
+        printf("ex46: %s, %d threads x %d rounds of %d map inserts: %.1f ms\n", allocator, threads, rounds, keys,
+               ms(t1 - t0).count());
+#ifdef POOL_NEW
+        pool_new::print_stats(stdout);
+#endif
+    }
+} // namespace ex46
+
 int
 main()
 {
@@ -1638,6 +5283,7 @@ main()
     ex13::test();
     ex14::test();
     ex15::test();
+    ex15::test2();
     ex21::test();
     ex24::test();
     ex25::test();
@@ -1645,4 +5291,18 @@ main()
     ex30::test();
     ex32::test();
     ex32::test2();
+    ex38::test();
+    ex39::test();
+    ex40::test();
+    ex41::test();
+    ex41::bench();
+    ex42::test();
+    ex42::bench();
+    ex43::test();
+    ex44::test();
+    ex44::bench();
+    ex45::test();
+    ex45::bench();
+    ex46::test();
+    ex46::bench();
 }
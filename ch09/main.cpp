@@ -1,26 +1,71 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <climits>
 #include <clocale>
+#include <condition_variable>
 #include <cstdarg>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <expected>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <span>
 #include <sstream>
+#include <streambuf>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <system_error>
 #include <thread>
+#include <type_traits>
 #include <unistd.h>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#if __has_include(<format>)
+#include <format>
+#endif
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
 #include <boost/format.hpp>
 #pragma GCC diagnostic pop
 
-#if 0
+#include "../common/bench.h"
+#include "../common/line_reader.h"
+
+#if __has_include(<charconv>)
 #include <charconv>
 #else
 #include <system_error>
@@ -1054,6 +1099,4247 @@ namespace ex46
     }
 } // namespace ex46
 
+namespace ex49
+{
+    // ex49
+    enum class access_hint
+    {
+        normal     = MADV_NORMAL,
+        sequential = MADV_SEQUENTIAL,
+        random     = MADV_RANDOM,
+        willneed   = MADV_WILLNEED,
+    };
+
+    // A file mapped into memory: its contents can be parsed in place,
+    // with no read() copying them into a buffer first. The writable
+    // flavor can also grow or shrink the file.
+    template <bool Writable>
+    class basic_mapped_file
+    {
+        using byte_type = std::conditional_t<Writable, std::byte, const std::byte>;
+
+        int        m_fd   = -1;
+        std::byte *m_data = nullptr;
+        size_t     m_size = 0;
+
+        static void
+        fail(const char *what)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        void
+        map(size_t size)
+        {
+            m_size = size;
+            if (size == 0)
+            {
+                m_data = nullptr; // mmap refuses empty mappings
+                return;
+            }
+            int   prot = Writable ? PROT_READ | PROT_WRITE : PROT_READ;
+            void *p    = mmap(nullptr, size, prot, MAP_SHARED, m_fd, 0);
+            if (p == MAP_FAILED)
+            {
+                fail("mmap");
+            }
+            m_data = static_cast<std::byte *>(p);
+        }
+
+        void
+        unmap()
+        {
+            if (m_data)
+            {
+                munmap(m_data, m_size);
+                m_data = nullptr;
+            }
+        }
+
+      public:
+        // Read-only: maps the whole file. Read-write: creates the file if
+        // needed, and resizes it to "size" unless that is -1.
+        explicit basic_mapped_file(const char *path, access_hint hint = access_hint::normal, size_t size = -1)
+        {
+            m_fd = Writable ? ::open(path, O_RDWR | O_CREAT, 0644) : ::open(path, O_RDONLY);
+            if (m_fd == -1)
+            {
+                fail("open");
+            }
+            if (Writable && size != size_t(-1) && ftruncate(m_fd, size) == -1)
+            {
+                int err = errno;
+                ::close(m_fd);
+                errno = err;
+                fail("ftruncate");
+            }
+            struct stat st;
+            fstat(m_fd, &st);
+            try
+            {
+                map(st.st_size);
+            }
+            catch (...)
+            {
+                ::close(m_fd);
+                throw;
+            }
+            advise(hint);
+        }
+
+        basic_mapped_file(basic_mapped_file &&rhs) noexcept
+            : m_fd(std::exchange(rhs.m_fd, -1)), m_data(std::exchange(rhs.m_data, nullptr)),
+              m_size(std::exchange(rhs.m_size, 0))
+        {
+        }
+
+        basic_mapped_file &operator=(basic_mapped_file &&) = delete;
+
+        ~basic_mapped_file()
+        {
+            unmap();
+            if (m_fd != -1)
+            {
+                ::close(m_fd);
+            }
+        }
+
+        void
+        advise(access_hint hint, size_t offset = 0, size_t length = -1)
+        {
+            if (m_data && offset < m_size)
+            {
+                // madvise wants a page-aligned start.
+                size_t start = offset - offset % sysconf(_SC_PAGESIZE);
+                madvise(m_data + start, std::min(length, m_size - offset) + (offset - start), int(hint));
+            }
+        }
+
+        std::span<byte_type>
+        bytes() const
+        {
+            return {m_data, m_size};
+        }
+
+        std::string_view
+        view() const
+        {
+            return {reinterpret_cast<const char *>(m_data), m_size};
+        }
+
+        size_t
+        size() const
+        {
+            return m_size;
+        }
+
+        void
+        resize(size_t size)
+            requires Writable
+        {
+            if (ftruncate(m_fd, size) == -1)
+            {
+                fail("ftruncate");
+            }
+            unmap();
+            map(size);
+        }
+
+        // Like fflush: push our changes out to the file now.
+        void
+        sync()
+            requires Writable
+        {
+            if (m_data && msync(m_data, m_size, MS_SYNC) == -1)
+            {
+                fail("msync");
+            }
+        }
+    };
+
+    using mapped_file          = basic_mapped_file<false>;
+    using writable_mapped_file = basic_mapped_file<true>;
+
+    void
+    test()
+    {
+        {
+            writable_mapped_file fw("myfile.txt", access_hint::normal, 11);
+            std::memcpy(fw.bytes().data(), "hello world", 11);
+            fw.resize(14);
+            std::memcpy(fw.bytes().data() + 6, "neighbor", 8);
+        }
+        mapped_file fr("myfile.txt", access_hint::sequential);
+        assert(fr.view() == "hello neighbor");
+        assert(fr.bytes().size() == 14 && fr.bytes()[0] == std::byte('h'));
+    }
+    // dex49
+
+    template <class F>
+    void
+    time_one(const char *name, size_t bytes, F f)
+    {
+        auto [n, s] = bench::timed(f);
+        printf("ex49: %-12s %8.1f ms %6.2f GB/s (%zu lines)\n", name, s * 1e3, bytes / s / 1e9, n);
+    }
+
+    void
+    bench()
+    {
+        constexpr size_t bytes = 64 << 20;
+        const char      *path  = "ex49.dat";
+        {
+            writable_mapped_file f(path, access_hint::sequential, bytes);
+            auto                 b = f.bytes();
+            for (size_t i = 0; i < bytes; ++i)
+            {
+                b[i] = std::byte(i % 64 == 63 ? '\n' : 'a' + i % 26);
+            }
+        }
+        auto count_lines = [](const char *p, size_t n) { return size_t(std::count(p, p + n, '\n')); };
+        static char buffer[1 << 16];
+
+        time_one("read(2)", bytes, [&] {
+            int    fd    = open(path, O_RDONLY);
+            size_t lines = 0;
+            for (ssize_t n; (n = read(fd, buffer, sizeof buffer)) > 0;)
+            {
+                lines += count_lines(buffer, n);
+            }
+            close(fd);
+            return lines;
+        });
+        time_one("fstream", bytes, [&] {
+            std::fstream fs(path, std::ios_base::in);
+            size_t       lines = 0;
+            while (fs.read(buffer, sizeof buffer) || fs.gcount() != 0)
+            {
+                lines += count_lines(buffer, fs.gcount());
+            }
+            return lines;
+        });
+        time_one("fread", bytes, [&] {
+            FILE  *fp    = fopen(path, "r");
+            size_t lines = 0;
+            for (size_t n; (n = fread(buffer, 1, sizeof buffer, fp)) > 0;)
+            {
+                lines += count_lines(buffer, n);
+            }
+            fclose(fp);
+            return lines;
+        });
+        time_one("mapped_file", bytes, [&] {
+            mapped_file f(path, access_hint::sequential);
+            return count_lines(f.view().data(), f.size());
+        });
+        unlink(path);
+    }
+} // namespace ex49
+
+namespace ex50
+{
+    // ex50
+    using ex7::LWC;
+
+    // isspace() in the "C" locale: ' ' and '\t' through '\r'.
+    inline bool
+    is_space(unsigned char ch)
+    {
+        return ch == ' ' || unsigned(ch - '\t') <= '\r' - '\t';
+    }
+
+    struct masks
+    {
+        uint64_t nonspace, newline;
+    };
+
+    // Classifies the 64 bytes at p; bit i describes p[i].
+    inline masks
+    classify64(const char *p)
+    {
+#if defined(__SSE2__)
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i tab   = _mm_set1_epi8('\t');
+        const __m128i four  = _mm_set1_epi8('\r' - '\t');
+        const __m128i nl    = _mm_set1_epi8('\n');
+        uint64_t      sp = 0, lf = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i v   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+            __m128i t   = _mm_sub_epi8(v, tab);
+            __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, four), t); // unsigned t <= 4
+            __m128i ws  = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, space));
+            sp |= uint64_t(uint16_t(_mm_movemask_epi8(ws))) << (16 * i);
+            lf |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)))) << (16 * i);
+        }
+        return {~sp, lf};
+#else
+        masks m{0, 0};
+        for (int i = 0; i < 64; ++i)
+        {
+            m.nonspace |= uint64_t(!is_space(p[i])) << i;
+            m.newline |= uint64_t(p[i] == '\n') << i;
+        }
+        return m;
+#endif
+    }
+
+    // Counts [p, p+n) exactly as ex7::word_count would. "in_space" says
+    // whether the byte before p was whitespace, and is updated to match
+    // the last byte, so blocks can be fed in one after another.
+    inline LWC
+    count_block(const char *p, size_t n, bool &in_space)
+    {
+        LWC      r{0, 0, int(n)};
+        uint64_t carry = !in_space; // was the previous byte a non-space?
+        size_t   i     = 0;
+        for (; i + 64 <= n; i += 64)
+        {
+            auto [ns, lf] = classify64(p + i);
+            r.lines += std::popcount(lf);
+            r.words += std::popcount(ns & ~((ns << 1) | carry));
+            carry = ns >> 63;
+        }
+        in_space = !carry;
+        for (; i < n; ++i)
+        {
+            bool sp = is_space(p[i]);
+            r.lines += (p[i] == '\n');
+            r.words += (in_space && !sp);
+            in_space = sp;
+        }
+        return r;
+    }
+
+    inline LWC &
+    operator+=(LWC &a, const LWC &b)
+    {
+        a.lines += b.lines;
+        a.words += b.words;
+        a.chars += b.chars;
+        return a;
+    }
+
+    // For pipes and terminals: stream through a large buffer with read(2).
+    LWC
+    word_count(int fd)
+    {
+        constexpr size_t        bufsize = 1 << 16;
+        std::unique_ptr<char[]> buffer(new char[bufsize]);
+        LWC                     r{};
+        bool                    in_space = true;
+        for (ssize_t n; (n = read(fd, buffer.get(), bufsize)) > 0;)
+        {
+            r += count_block(buffer.get(), n, in_space);
+        }
+        return r;
+    }
+
+    // For files: map them, and split large ones across threads. Each
+    // chunk can see the byte before it, so no fix-up is needed at joins.
+    LWC
+    word_count(const char *path, unsigned threads = 0)
+    {
+        ex49::mapped_file f(path, ex49::access_hint::sequential);
+        std::string_view  s = f.view();
+        size_t            chunks;
+        if (threads == 0)
+        {
+            constexpr size_t min_chunk = 4 << 20;
+            chunks = std::clamp<size_t>(s.size() / min_chunk, 1, std::max(std::thread::hardware_concurrency(), 1u));
+        }
+        else
+        {
+            chunks = std::clamp<size_t>(s.size(), 1, threads);
+        }
+
+        std::vector<LWC>         parts(chunks);
+        std::vector<std::thread> pool;
+        for (size_t k = 0; k < chunks; ++k)
+        {
+            size_t begin = s.size() * k / chunks;
+            size_t end   = s.size() * (k + 1) / chunks;
+            bool   sp    = (begin == 0) || is_space(s[begin - 1]);
+            auto   job   = [&parts, &s, k, begin, end, sp] {
+                bool in_space = sp;
+                parts[k]      = count_block(s.data() + begin, end - begin, in_space);
+            };
+            if (k + 1 == chunks)
+            {
+                job(); // the last chunk runs on this thread
+            }
+            else
+            {
+                pool.emplace_back(job);
+            }
+        }
+        for (auto &t : pool)
+        {
+            t.join();
+        }
+
+        LWC r{};
+        for (const LWC &part : parts)
+        {
+            r += part;
+        }
+        return r;
+    }
+
+    bool
+    operator==(const LWC &a, const LWC &b)
+    {
+        return a.lines == b.lines && a.words == b.words && a.chars == b.chars;
+    }
+
+    LWC
+    reference_count(const char *path)
+    {
+        FILE *fp = fopen(path, "r");
+        LWC   r  = ex7::word_count(fp);
+        fclose(fp);
+        return r;
+    }
+
+    void
+    test()
+    {
+        const char *path = "myfile.txt";
+        // Every whitespace byte, a high-bit byte, words straddling the 64-byte
+        // blocks and the chunk boundaries, plus a long random tail.
+        std::string text = "  hello\tworld\n\v\f\rx \xa0y\n";
+        text += std::string(60, 'z') + "  " + std::string(70, 'w') + "\n";
+        unsigned seed = 12345;
+        for (int i = 0; i < 100000; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            text += " \n\tab\x85\r"[(seed >> 16) % 8];
+        }
+
+        for (size_t len : {size_t(0), size_t(1), size_t(63), size_t(64), size_t(65), size_t(200), text.size()})
+        {
+            FILE *fp = fopen(path, "w");
+            fwrite(text.data(), 1, len, fp);
+            fclose(fp);
+
+            LWC expected = reference_count(path);
+            for (unsigned threads : {0u, 1u, 3u, 7u})
+            {
+                assert(word_count(path, threads) == expected);
+            }
+            int fd = open(path, O_RDONLY);
+            assert(word_count(fd) == expected);
+            close(fd);
+        }
+    }
+    // dex50
+
+    void
+    bench()
+    {
+        constexpr size_t bytes = 64 << 20;
+        const char      *path  = "ex50.dat";
+        {
+            ex49::writable_mapped_file f(path, ex49::access_hint::sequential, bytes);
+            auto                       b = f.bytes();
+            for (size_t i = 0; i < bytes; ++i)
+            {
+                b[i] = std::byte(i % 61 == 60 ? '\n' : i % 7 == 6 ? ' ' : 'a' + i % 26);
+            }
+        }
+
+        auto time_one = [&](const char *name, auto f) {
+            auto [r, s] = bench::timed(f);
+            printf("ex50: %-12s %8.1f ms %6.2f GB/s (%d %d %d)\n", name, s * 1e3, bytes / s / 1e9, r.lines, r.words,
+                   r.chars);
+        };
+        time_one("getc", [&] { return reference_count(path); });
+        time_one("read(2)", [&] {
+            int fd = open(path, O_RDONLY);
+            LWC r  = word_count(fd);
+            close(fd);
+            return r;
+        });
+        time_one("mapped", [&] { return word_count(path, 1); });
+        time_one("threaded", [&] { return word_count(path); });
+        unlink(path);
+    }
+} // namespace ex50
+
+namespace ex51
+{
+    // ex51
+    // Callbacks receive what pread/pwrite would have returned, except
+    // that an error arrives as -errno instead of -1 (as io_uring does).
+    using io_callback = std::function<void(ssize_t)>;
+
+    class io_engine
+    {
+      public:
+        virtual ~io_engine() = default;
+
+        // Queue a request. Nothing is guaranteed to start until submit().
+        virtual void read(int fd, void *buf, size_t len, off_t offset, io_callback done)        = 0;
+        virtual void write(int fd, const void *buf, size_t len, off_t offset, io_callback done) = 0;
+
+        // Hand every queued request over in one batch.
+        virtual void submit() = 0;
+
+        // Block until at least "min" requests have completed, then run the
+        // callbacks of all completed requests on this thread.
+        virtual size_t wait(size_t min = 1) = 0;
+
+        virtual size_t in_flight() const = 0;
+
+        // Requests that fall inside a registered buffer may skip pinning
+        // its pages each time. The buffers must outlive the registration.
+        virtual bool
+        register_buffers(std::span<const iovec>)
+        {
+            return false;
+        }
+        virtual void
+        unregister_buffers()
+        {
+        }
+
+        virtual const char *name() const = 0;
+
+        void
+        drain()
+        {
+            submit();
+            while (in_flight() != 0)
+            {
+                wait(1);
+            }
+        }
+    };
+
+    // The portable fallback: worker threads doing pread and pwrite.
+    class thread_pool_engine : public io_engine
+    {
+        struct request
+        {
+            int         fd;
+            void       *buf;
+            size_t      len;
+            off_t       offset;
+            bool        write;
+            io_callback done;
+            ssize_t     result;
+        };
+
+        std::deque<request>      m_pending; // not yet submitted
+        size_t                   m_in_flight = 0;
+        std::mutex               m_mtx;
+        std::condition_variable  m_work_cv;
+        std::condition_variable  m_done_cv;
+        std::deque<request>      m_queue; // guarded by m_mtx
+        std::deque<request>      m_done;  // guarded by m_mtx
+        bool                     m_stop = false;
+        std::vector<std::thread> m_workers;
+
+        void
+        work()
+        {
+            std::unique_lock lk(m_mtx);
+            while (true)
+            {
+                m_work_cv.wait(lk, [&] { return m_stop || !m_queue.empty(); });
+                if (m_queue.empty())
+                {
+                    return;
+                }
+                request r = std::move(m_queue.front());
+                m_queue.pop_front();
+                lk.unlock();
+                ssize_t n = r.write ? pwrite(r.fd, r.buf, r.len, r.offset) : pread(r.fd, r.buf, r.len, r.offset);
+                r.result  = (n < 0) ? -errno : n;
+                lk.lock();
+                m_done.push_back(std::move(r));
+                m_done_cv.notify_one();
+            }
+        }
+
+        void
+        queue(int fd, const void *buf, size_t len, off_t offset, bool write, io_callback done)
+        {
+            m_pending.push_back({fd, const_cast<void *>(buf), len, offset, write, std::move(done), 0});
+            m_in_flight += 1;
+        }
+
+      public:
+        explicit thread_pool_engine(unsigned threads = 4)
+        {
+            for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+            {
+                m_workers.emplace_back([this] { work(); });
+            }
+        }
+
+        ~thread_pool_engine()
+        {
+            {
+                std::lock_guard lk(m_mtx);
+                m_stop = true;
+            }
+            m_work_cv.notify_all();
+            for (auto &t : m_workers)
+            {
+                t.join();
+            }
+        }
+
+        void
+        read(int fd, void *buf, size_t len, off_t offset, io_callback done) override
+        {
+            queue(fd, buf, len, offset, false, std::move(done));
+        }
+
+        void
+        write(int fd, const void *buf, size_t len, off_t offset, io_callback done) override
+        {
+            queue(fd, buf, len, offset, true, std::move(done));
+        }
+
+        void
+        submit() override
+        {
+            if (m_pending.empty())
+            {
+                return;
+            }
+            {
+                std::lock_guard lk(m_mtx);
+                std::move(m_pending.begin(), m_pending.end(), std::back_inserter(m_queue));
+            }
+            m_pending.clear();
+            m_work_cv.notify_all();
+        }
+
+        size_t
+        wait(size_t min) override
+        {
+            submit();
+            min = std::min(min, m_in_flight);
+            std::deque<request> batch;
+            {
+                std::unique_lock lk(m_mtx);
+                m_done_cv.wait(lk, [&] { return m_done.size() >= min; });
+                batch.swap(m_done);
+            }
+            m_in_flight -= batch.size();
+            for (request &r : batch)
+            {
+                if (r.done)
+                {
+                    r.done(r.result);
+                }
+            }
+            return batch.size();
+        }
+
+        size_t
+        in_flight() const override
+        {
+            return m_in_flight;
+        }
+
+        const char *
+        name() const override
+        {
+            return "threads";
+        }
+    };
+
+#if __has_include(<linux/io_uring.h>)
+    // io_uring through the raw system calls. Callbacks are indexed by the
+    // user_data of each request; the completion ring's size caps how many
+    // requests can be in flight, so it can never overflow.
+    class uring_engine : public io_engine
+    {
+        // What a single read or write can transfer on Linux (MAX_RW_COUNT),
+        // and so the most pread and pwrite ever return.
+        static constexpr size_t max_transfer = 0x7ffff000;
+
+        int                      m_fd      = -1;
+        void                    *m_sq_ring = MAP_FAILED;
+        void                    *m_cq_ring = MAP_FAILED;
+        void                    *m_sqes    = MAP_FAILED;
+        size_t                   m_sq_ring_size;
+        size_t                   m_cq_ring_size;
+        size_t                   m_sqes_size;
+        unsigned                *m_sq_head;
+        unsigned                *m_sq_tail;
+        unsigned                 m_sq_mask;
+        unsigned                *m_sq_array;
+        unsigned                *m_cq_head;
+        unsigned                *m_cq_tail;
+        unsigned                 m_cq_mask;
+        io_uring_cqe            *m_cqes;
+        unsigned                 m_sq_entries;
+        unsigned                 m_queued = 0; // written to the ring but not yet submitted
+        std::vector<io_callback> m_callbacks;
+        std::vector<unsigned>    m_free_slots;
+        std::vector<iovec>       m_registered;
+
+        static std::atomic_ref<unsigned>
+        shared(unsigned *p)
+        {
+            return std::atomic_ref<unsigned>(*p);
+        }
+
+        static void
+        fail(const char *what)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        int
+        enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+        {
+            return syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, nullptr, 0);
+        }
+
+        void
+        close_ring()
+        {
+            if (m_sqes != MAP_FAILED)
+            {
+                munmap(m_sqes, m_sqes_size);
+            }
+            if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+            {
+                munmap(m_cq_ring, m_cq_ring_size);
+            }
+            if (m_sq_ring != MAP_FAILED)
+            {
+                munmap(m_sq_ring, m_sq_ring_size);
+            }
+            if (m_fd != -1)
+            {
+                ::close(m_fd);
+            }
+        }
+
+        // IORING_OP_READ and IORING_OP_WRITE arrived in Linux 5.6, together
+        // with the probe; older kernels set up a ring just fine and then
+        // fail every one of our requests with EINVAL.
+        bool
+        supports_read_write()
+        {
+            constexpr unsigned max_ops = 256;
+            alignas(io_uring_probe) char buffer[sizeof(io_uring_probe) + max_ops * sizeof(io_uring_probe_op)] = {};
+            auto *probe = reinterpret_cast<io_uring_probe *>(buffer);
+            if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, max_ops) < 0)
+            {
+                return false;
+            }
+            auto supported = [&](unsigned op) {
+                return op <= probe->last_op && op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+            };
+            return supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+        }
+
+        void *
+        map_ring(size_t size, off_t what)
+        {
+            void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, what);
+            if (p == MAP_FAILED)
+            {
+                int err = errno;
+                close_ring();
+                errno = err;
+                fail("mmap");
+            }
+            return p;
+        }
+
+        void
+        queue(uint8_t opcode, int fd, const void *buf, size_t len, off_t offset, io_callback done)
+        {
+            if (m_free_slots.empty())
+            {
+                wait(1);
+            }
+            if (m_queued == m_sq_entries)
+            {
+                submit();
+            }
+            unsigned slot = m_free_slots.back();
+            m_free_slots.pop_back();
+            m_callbacks[slot] = std::move(done);
+
+            unsigned      tail = *m_sq_tail; // only we move the tail
+            unsigned      idx  = tail & m_sq_mask;
+            io_uring_sqe &sqe  = static_cast<io_uring_sqe *>(m_sqes)[idx];
+            sqe                = {};
+            sqe.opcode         = opcode;
+            sqe.fd             = fd;
+            sqe.off            = offset;
+            sqe.addr           = reinterpret_cast<uintptr_t>(buf);
+            sqe.len            = std::min(len, max_transfer); // sqe.len is 32 bits; see read()
+            sqe.user_data      = slot;
+            for (size_t i = 0; i < m_registered.size(); ++i)
+            {
+                auto *base = static_cast<const char *>(m_registered[i].iov_base);
+                auto *p    = static_cast<const char *>(buf);
+                if (base <= p && p + len <= base + m_registered[i].iov_len)
+                {
+                    sqe.opcode    = (opcode == IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                    sqe.buf_index = i;
+                    break;
+                }
+            }
+            m_sq_array[idx] = idx;
+            shared(m_sq_tail).store(tail + 1, std::memory_order_release);
+            m_queued += 1;
+        }
+
+        size_t
+        reap()
+        {
+            size_t   n    = 0;
+            unsigned head = *m_cq_head;
+            while (head != shared(m_cq_tail).load(std::memory_order_acquire))
+            {
+                io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+                shared(m_cq_head).store(++head, std::memory_order_release);
+                io_callback done = std::move(m_callbacks[cqe.user_data]);
+                m_free_slots.push_back(cqe.user_data);
+                if (done)
+                {
+                    done(cqe.res);
+                }
+                n += 1;
+            }
+            return n;
+        }
+
+      public:
+        explicit uring_engine(unsigned queue_depth = 64)
+        {
+            io_uring_params p{};
+            m_fd = syscall(__NR_io_uring_setup, std::max(queue_depth, 1u), &p);
+            if (m_fd < 0)
+            {
+                m_fd = -1;
+                fail("io_uring_setup");
+            }
+            if (!supports_read_write())
+            {
+                close_ring();
+                errno = EOPNOTSUPP;
+                fail("IORING_OP_READ");
+            }
+            m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            m_sqes_size    = p.sq_entries * sizeof(io_uring_sqe);
+            if (p.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+                m_sq_ring = m_cq_ring = map_ring(m_sq_ring_size, IORING_OFF_SQ_RING);
+            }
+            else
+            {
+                m_sq_ring = map_ring(m_sq_ring_size, IORING_OFF_SQ_RING);
+                m_cq_ring = map_ring(m_cq_ring_size, IORING_OFF_CQ_RING);
+            }
+            m_sqes = map_ring(m_sqes_size, IORING_OFF_SQES);
+
+            auto *sq     = static_cast<char *>(m_sq_ring);
+            auto *cq     = static_cast<char *>(m_cq_ring);
+            m_sq_head    = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+            m_sq_tail    = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            m_sq_mask    = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            m_sq_array   = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+            m_cq_head    = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            m_cq_tail    = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            m_cq_mask    = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+            m_cqes       = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+            m_sq_entries = p.sq_entries;
+            m_callbacks.resize(p.cq_entries);
+            for (unsigned i = p.cq_entries; i != 0; --i)
+            {
+                m_free_slots.push_back(i - 1);
+            }
+        }
+
+        uring_engine(const uring_engine &) = delete;
+
+        ~uring_engine()
+        {
+            close_ring();
+        }
+
+        // Like pread and pwrite, a request for more than max_transfer bytes
+        // transfers at most that many, and the callback gets the short count.
+        void
+        read(int fd, void *buf, size_t len, off_t offset, io_callback done) override
+        {
+            queue(IORING_OP_READ, fd, buf, len, offset, std::move(done));
+        }
+
+        void
+        write(int fd, const void *buf, size_t len, off_t offset, io_callback done) override
+        {
+            queue(IORING_OP_WRITE, fd, buf, len, offset, std::move(done));
+        }
+
+        void
+        submit() override
+        {
+            while (m_queued != 0)
+            {
+                int n = enter(m_queued, 0, 0);
+                if (n > 0)
+                {
+                    m_queued -= n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n < 0 && errno != EAGAIN && errno != EBUSY)
+                {
+                    fail("io_uring_enter");
+                }
+                // The kernel took nothing for now (out of resources, or its
+                // completions need reaping first): wait for one of the requests
+                // it already has to finish, rather than spin. With none, we'd
+                // wait forever.
+                if (in_flight() == m_queued)
+                {
+                    errno = (n < 0) ? errno : EAGAIN;
+                    fail("io_uring_enter");
+                }
+                if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                {
+                    fail("io_uring_enter");
+                }
+                reap();
+            }
+        }
+
+        size_t
+        wait(size_t min) override
+        {
+            submit();
+            min      = std::min(min, in_flight());
+            size_t n = reap();
+            while (n < min)
+            {
+                if (enter(0, min - n, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                {
+                    fail("io_uring_enter");
+                }
+                n += reap();
+            }
+            return n;
+        }
+
+        size_t
+        in_flight() const override
+        {
+            return m_callbacks.size() - m_free_slots.size();
+        }
+
+        bool
+        register_buffers(std::span<const iovec> iov) override
+        {
+            unregister_buffers();
+            if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) < 0)
+            {
+                return false; // e.g. over RLIMIT_MEMLOCK; plain requests still work
+            }
+            m_registered.assign(iov.begin(), iov.end());
+            return true;
+        }
+
+        void
+        unregister_buffers() override
+        {
+            if (!m_registered.empty())
+            {
+                syscall(__NR_io_uring_register, m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+                m_registered.clear();
+            }
+        }
+
+        const char *
+        name() const override
+        {
+            return "io_uring";
+        }
+    };
+#endif
+
+    std::unique_ptr<io_engine>
+    make_io_engine(unsigned queue_depth = 64)
+    {
+#if __has_include(<linux/io_uring.h>)
+        try
+        {
+            return std::make_unique<uring_engine>(queue_depth);
+        }
+        catch (const std::system_error &)
+        {
+            // ENOSYS, or forbidden by a seccomp filter: use threads.
+        }
+#endif
+        return std::make_unique<thread_pool_engine>(std::clamp(queue_depth, 1u, 16u));
+    }
+
+    void
+    check(io_engine &e)
+    {
+        const char      *path   = "myfile.txt";
+        int              fd     = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        constexpr size_t block  = 4096;
+        constexpr size_t blocks = 64;
+        std::string      out(block * blocks, ' ');
+        for (size_t i = 0; i < out.size(); ++i)
+        {
+            out[i] = 'a' + (i / block + i) % 26;
+        }
+
+        size_t written = 0;
+        for (size_t b = 0; b < blocks; ++b)
+        {
+            e.write(fd, &out[b * block], block, b * block, [&](ssize_t n) { written += n; });
+        }
+        e.drain();
+        assert(written == out.size());
+
+        std::string in(out.size(), ' ');
+        iovec       iov{in.data(), in.size()};
+        e.register_buffers({&iov, 1});
+        size_t reads = 0;
+        for (size_t b = blocks; b-- != 0;)
+        {
+            e.read(fd, &in[b * block], block, b * block, [&](ssize_t n) { reads += (n == block); });
+        }
+        e.drain();
+        e.unregister_buffers();
+        assert(reads == blocks && in == out);
+
+        ssize_t bad = 1, eof = 1;
+        e.read(-1, in.data(), 1, 0, [&](ssize_t n) { bad = n; });
+        e.read(fd, in.data(), 1, out.size(), [&](ssize_t n) { eof = n; });
+        e.drain();
+        assert(bad == -EBADF && eof == 0);
+
+        // A length that doesn't fit in 32 bits still reads up to end of file.
+        ssize_t whole = 0;
+        e.read(fd, in.data(), (size_t(1) << 32) + 1, 0, [&](ssize_t n) { whole = n; });
+        e.drain();
+        assert(whole == ssize_t(out.size()) && in == out);
+        close(fd);
+    }
+
+    void
+    test()
+    {
+        thread_pool_engine pool(4);
+        check(pool);
+        check(*make_io_engine(8)); // fewer slots than requests
+    }
+    // dex51
+
+    void
+    run(io_engine &e, int fd, size_t file_size, unsigned depth, size_t block, bool random)
+    {
+        std::string buffers(depth * block, ' ');
+        iovec       iov{buffers.data(), buffers.size()};
+        e.register_buffers({&iov, 1});
+        std::vector<unsigned> free_buffers(depth);
+        std::iota(free_buffers.begin(), free_buffers.end(), 0u);
+
+        size_t   count  = random ? 16384 : file_size / block;
+        size_t   issued = 0, done = 0, bytes = 0;
+        unsigned seed   = 1;
+        double   s      = bench::timed([&] {
+            while (done < count)
+            {
+                while (issued < count && !free_buffers.empty())
+                {
+                    unsigned b = free_buffers.back();
+                    free_buffers.pop_back();
+                    seed         = seed * 1103515245 + 12345;
+                    size_t index = random ? (seed >> 8) % (file_size / block) : issued;
+                    e.read(fd, &buffers[b * block], block, index * block, [&, b](ssize_t n) {
+                        bytes += n;
+                        done += 1;
+                        free_buffers.push_back(b);
+                    });
+                    issued += 1;
+                }
+                e.wait(1);
+            }
+        }).seconds;
+        e.unregister_buffers();
+        printf("ex51: %-8s %-10s qd=%-3u %8.1f MB/s %9.0f IOPS\n", e.name(), random ? "random 4K" : "seq 128K", depth,
+               bytes / s / 1e6, count / s);
+    }
+
+    void
+    bench()
+    {
+        constexpr size_t file_size = 64 << 20;
+        const char      *path      = "ex51.dat";
+        {
+            ex49::writable_mapped_file f(path, ex49::access_hint::sequential, file_size);
+            std::memset(f.bytes().data(), 'x', file_size);
+        }
+        int fd = open(path, O_RDONLY);
+        for (bool random : {false, true})
+        {
+            for (unsigned depth : {1u, 4u, 16u, 64u})
+            {
+                size_t block = random ? 4096 : 128 << 10;
+                auto   e     = make_io_engine(depth);
+                run(*e, fd, file_size, depth, block, random);
+                thread_pool_engine pool(depth);
+                run(pool, fd, file_size, depth, block, random);
+            }
+        }
+        close(fd);
+        unlink(path);
+    }
+} // namespace ex51
+
+namespace ex52
+{
+    // ex52
+    struct writer_options
+    {
+        size_t buffer_size = 0;     // 0: sixteen of the target's st_blksize blocks
+        bool   direct      = false; // O_DIRECT, where the file system supports it
+    };
+
+    // Like a FILE opened for writing, with the same rule as ex8: a write
+    // that overflows the buffer sends out whole buffers' worth and keeps
+    // the remainder. Those whole buffers go to writev straight from the
+    // caller's memory instead of being copied first.
+    class buffered_writer
+    {
+        struct free_deleter
+        {
+            void
+            operator()(char *p) const
+            {
+                free(p);
+            }
+        };
+
+        int                                   m_fd     = -1;
+        bool                                  m_owned  = false;
+        bool                                  m_direct = false;
+        std::unique_ptr<char[], free_deleter> m_buffer;
+        size_t                                m_block    = 4096;
+        size_t                                m_capacity = 0;
+        size_t                                m_used     = 0;
+        off_t                                 m_position = 0; // file offset of m_buffer[0]
+
+        static void
+        fail(const char *what)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        void
+        init(const writer_options &opt)
+        {
+            struct stat st;
+            if (fstat(m_fd, &st) == 0 && st.st_blksize > 0)
+            {
+                m_block = st.st_blksize;
+            }
+            size_t page = sysconf(_SC_PAGESIZE);
+            m_capacity  = opt.buffer_size ? opt.buffer_size : 16 * std::max(m_block, page);
+            void *p     = aligned_alloc(page, (m_capacity + page - 1) / page * page);
+            if (p == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            m_buffer.reset(static_cast<char *>(p));
+            m_position = std::max(lseek(m_fd, 0, SEEK_CUR), off_t(0));
+            if (opt.direct)
+            {
+                set_direct(true);
+            }
+        }
+
+        // O_DIRECT needs block-aligned offsets and lengths, so it is only
+        // kept on while every write is a whole buffer.
+        void
+        set_direct(bool on)
+        {
+            bool aligned = m_capacity % m_block == 0 && m_position % m_block == 0;
+            int  flags   = fcntl(m_fd, F_GETFL);
+            if (flags != -1 && (!on || aligned))
+            {
+                flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+                if (fcntl(m_fd, F_SETFL, flags) == 0)
+                {
+                    m_direct = on;
+                }
+            }
+        }
+
+        void
+        write_all(iovec *iov, int count)
+        {
+            while (count != 0)
+            {
+                ssize_t n = writev(m_fd, iov, count);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    fail("writev");
+                }
+                m_position += n;
+                for (; count != 0 && size_t(n) >= iov->iov_len; ++iov, --count)
+                {
+                    n -= iov->iov_len;
+                }
+                if (count != 0)
+                {
+                    iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+                    iov->iov_len -= n;
+                }
+            }
+        }
+
+        void
+        write_buffer()
+        {
+            iovec iov{m_buffer.get(), m_used};
+            write_all(&iov, 1);
+            m_used = 0;
+        }
+
+      public:
+        explicit buffered_writer(int fd, writer_options opt = {}) : m_fd(fd)
+        {
+            init(opt);
+        }
+
+        explicit buffered_writer(const char *path, writer_options opt = {})
+            : m_fd(::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)), m_owned(true)
+        {
+            if (m_fd == -1)
+            {
+                fail("open");
+            }
+            init(opt);
+        }
+
+        buffered_writer(const buffered_writer &) = delete;
+
+        ~buffered_writer()
+        {
+            try
+            {
+                flush();
+            }
+            catch (const std::system_error &)
+            {
+            }
+            if (m_owned)
+            {
+                ::close(m_fd);
+            }
+        }
+
+        void
+        write(const void *data, size_t n)
+        {
+            auto *p = static_cast<const char *>(data);
+            if (n <= m_capacity - m_used)
+            {
+                std::memcpy(m_buffer.get() + m_used, p, n);
+                m_used += n;
+            }
+            else if (m_direct)
+            {
+                // The caller's memory need not be aligned, so copy everything.
+                while (n != 0)
+                {
+                    size_t k = std::min(n, m_capacity - m_used);
+                    std::memcpy(m_buffer.get() + m_used, p, k);
+                    m_used += k;
+                    p += k;
+                    n -= k;
+                    if (m_used == m_capacity)
+                    {
+                        write_buffer();
+                    }
+                }
+            }
+            else
+            {
+                size_t total  = m_used + n;
+                size_t direct = total - total % m_capacity;
+                iovec  iov[2] = {{m_buffer.get(), m_used}, {const_cast<char *>(p), direct - m_used}};
+                p += direct - m_used;
+                write_all(iov, 2);
+                m_used = total - direct;
+                std::memcpy(m_buffer.get(), p, m_used);
+            }
+        }
+
+        void
+        write(std::string_view s)
+        {
+            write(s.data(), s.size());
+        }
+
+        // Like fflush, as in ex9. A partial block can't be written with
+        // O_DIRECT, so that ends direct mode.
+        void
+        flush()
+        {
+            if (m_used != 0)
+            {
+                if (m_direct && m_used % m_block != 0)
+                {
+                    set_direct(false);
+                }
+                write_buffer();
+            }
+        }
+
+        // Like ftell: where the next byte will land.
+        off_t
+        tell() const
+        {
+            return m_position + m_used;
+        }
+
+        int
+        fd() const
+        {
+            return m_fd;
+        }
+
+        size_t
+        capacity() const
+        {
+            return m_capacity;
+        }
+
+        bool
+        direct() const
+        {
+            return m_direct;
+        }
+    };
+
+    std::string
+    slurp(const char *path)
+    {
+        ex49::mapped_file f(path);
+        return std::string(f.view());
+    }
+
+    void
+    test()
+    {
+        {
+            // ex8 and ex9, with a buffered_writer in place of the FILE.
+            buffered_writer w("myfile.txt", {.buffer_size = 150});
+            int             fd = w.fd();
+
+            std::string AAAA(160, 'A');
+            w.write(AAAA.data(), 160);
+            assert(lseek(fd, 0, SEEK_CUR) == 150);
+            assert(w.tell() == 160);
+            w.flush();
+            assert(lseek(fd, 0, SEEK_CUR) == 160);
+        }
+        assert(slurp("myfile.txt") == std::string(160, 'A'));
+
+        std::string big;
+        for (bool direct : {false, true})
+        {
+            buffered_writer w("myfile.txt", {.direct = direct});
+            size_t          cap = w.capacity();
+            assert(cap % sysconf(_SC_PAGESIZE) == 0);
+            big.assign(3 * cap + 5, 'b');
+            w.write("0123456789");
+            assert(w.tell() == 10 && lseek(w.fd(), 0, SEEK_CUR) == 0);
+            w.write(big);
+            assert(lseek(w.fd(), 0, SEEK_CUR) == off_t(3 * cap));
+            assert(w.tell() == off_t(3 * cap + 15));
+            w.write("end");
+        }
+        assert(slurp("myfile.txt") == "0123456789" + big + "end");
+    }
+    // dex52
+
+    void
+    bench()
+    {
+        const char *path     = "ex52.dat";
+        auto        time_one = [&](const char *name, size_t record, size_t count, auto write) {
+            std::string data(record, 'r');
+            double      s = bench::timed([&] { write(data, count); }).seconds;
+            printf("ex52: %-16s %7zu-byte records %8.1f MB/s\n", name, record, record * count / s / 1e6);
+        };
+        auto with_fwrite = [&](const std::string &data, size_t count) {
+            FILE *fp = fopen(path, "w");
+            for (size_t i = 0; i < count; ++i)
+            {
+                fwrite(data.data(), 1, data.size(), fp);
+            }
+            fclose(fp);
+        };
+        auto with_writer = [&](bool direct) {
+            return [&, direct](const std::string &data, size_t count) {
+                buffered_writer w(path, {.direct = direct});
+                for (size_t i = 0; i < count; ++i)
+                {
+                    w.write(data);
+                }
+            };
+        };
+
+        time_one("fwrite", 32, 2 << 20, with_fwrite);
+        time_one("buffered_writer", 32, 2 << 20, with_writer(false));
+        time_one("fwrite", 1 << 20, 64, with_fwrite);
+        time_one("buffered_writer", 1 << 20, 64, with_writer(false));
+        // set_direct quietly stays buffered where the file system refuses
+        // O_DIRECT (tmpfs, for one), so only label a row O_DIRECT if it is.
+        if (buffered_writer(path, {.direct = true}).direct())
+        {
+            time_one("O_DIRECT", 1 << 20, 64, with_writer(true));
+        }
+        else
+        {
+            printf("ex52: O_DIRECT not supported here, skipped\n");
+        }
+        unlink(path);
+    }
+} // namespace ex52
+
+namespace ex53
+{
+    // ex53
+    // A placeholder is "{}" or "{:[0][width][.precision][type]}", with
+    // the types d, x, X, o, b for integers, f, e, g for floating point,
+    // and s, c for strings, bools and chars. "{{" and "}}" are literal.
+    // A precision is the number of digits for floating point, and the
+    // maximum length for strings; other arguments don't take one.
+    struct format_spec
+    {
+        size_t begin     = 0; // the placeholder's text in the format string
+        size_t end       = 0;
+        int    width     = 0;
+        int    precision = -1;
+        char   type      = 0;
+        bool   zero_pad  = false;
+    };
+
+    enum class arg_kind
+    {
+        integer,
+        floating,
+        string,
+        character,
+        boolean,
+    };
+
+    template <class T>
+    consteval arg_kind
+    kind_of()
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return arg_kind::boolean;
+        }
+        else if constexpr (std::is_same_v<T, char>)
+        {
+            return arg_kind::character;
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            return arg_kind::integer;
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            return arg_kind::floating;
+        }
+        else
+        {
+            static_assert(std::is_convertible_v<const T &, std::string_view>, "unsupported argument type");
+            return arg_kind::string;
+        }
+    }
+
+    // Not constexpr: reaching it during constant evaluation is the error.
+    inline void
+    format_string_error(const char *)
+    {
+    }
+
+    template <class... Args>
+    class basic_format_string
+    {
+        std::string_view                         m_str;
+        std::array<format_spec, sizeof...(Args)> m_specs{};
+        bool                                     m_escapes = false;
+
+        static consteval bool
+        allows(arg_kind kind, char type)
+        {
+            std::string_view allowed;
+            switch (kind)
+            {
+            case arg_kind::integer:
+                allowed = "dxXob";
+                break;
+            case arg_kind::floating:
+                allowed = "feg";
+                break;
+            case arg_kind::character:
+                allowed = "c";
+                break;
+            default:
+                allowed = "s";
+                break;
+            }
+            return type == 0 || allowed.find(type) != allowed.npos;
+        }
+
+        consteval int
+        parse_int(size_t &i) const
+        {
+            int n = 0;
+            while (i < m_str.size() && '0' <= m_str[i] && m_str[i] <= '9')
+            {
+                n = 10 * n + (m_str[i++] - '0');
+                if (n > 100)
+                {
+                    format_string_error("width or precision over 100");
+                }
+            }
+            return n;
+        }
+
+        consteval void
+        parse()
+        {
+            constexpr arg_kind kinds[sizeof...(Args) + 1] = {kind_of<Args>()...};
+            size_t             n                          = 0;
+            for (size_t i = 0; i < m_str.size(); ++i)
+            {
+                if (m_str[i] == '}')
+                {
+                    if (i + 1 == m_str.size() || m_str[i + 1] != '}')
+                    {
+                        format_string_error("unmatched '}'");
+                    }
+                    m_escapes = true;
+                    ++i;
+                }
+                else if (m_str[i] == '{')
+                {
+                    if (i + 1 < m_str.size() && m_str[i + 1] == '{')
+                    {
+                        m_escapes = true;
+                        ++i;
+                        continue;
+                    }
+                    if (n == sizeof...(Args))
+                    {
+                        format_string_error("more placeholders than arguments");
+                    }
+                    format_spec &spec = m_specs[n];
+                    spec.begin        = i++;
+                    if (i < m_str.size() && m_str[i] == ':')
+                    {
+                        ++i;
+                        if (i < m_str.size() && m_str[i] == '0')
+                        {
+                            spec.zero_pad = true;
+                            ++i;
+                        }
+                        spec.width = parse_int(i);
+                        if (i < m_str.size() && m_str[i] == '.')
+                        {
+                            ++i;
+                            spec.precision = parse_int(i);
+                        }
+                        if (i < m_str.size() && m_str[i] != '}')
+                        {
+                            spec.type = m_str[i++];
+                        }
+                    }
+                    if (i == m_str.size() || m_str[i] != '}')
+                    {
+                        format_string_error("bad placeholder");
+                    }
+                    spec.end = i + 1;
+                    if (!allows(kinds[n], spec.type))
+                    {
+                        format_string_error("type does not match the argument");
+                    }
+                    if (spec.precision >= 0 && kinds[n] != arg_kind::floating && kinds[n] != arg_kind::string)
+                    {
+                        format_string_error("precision on an argument that doesn't take one");
+                    }
+                    n += 1;
+                }
+            }
+            if (n != sizeof...(Args))
+            {
+                format_string_error("fewer placeholders than arguments");
+            }
+        }
+
+      public:
+        template <class S>
+            requires std::is_convertible_v<const S &, std::string_view>
+        consteval basic_format_string(const S &s) : m_str(s)
+        {
+            parse();
+        }
+
+        std::string_view
+        get() const
+        {
+            return m_str;
+        }
+        const format_spec &
+        spec(size_t i) const
+        {
+            return m_specs[i];
+        }
+        bool
+        has_escapes() const
+        {
+            return m_escapes;
+        }
+    };
+
+    template <class... Args>
+    using format_string = basic_format_string<std::decay_t<Args>...>;
+
+    // Output goes straight into [m_ptr, m_end). Only running out of room
+    // costs a virtual call, to grow() the space or give up.
+    class format_sink
+    {
+      protected:
+        char  *m_ptr      = nullptr;
+        char  *m_end      = nullptr;
+        size_t m_overflow = 0; // bytes that didn't fit
+
+        virtual bool grow(size_t n) = 0;
+
+        bool
+        room_for(size_t n)
+        {
+            return size_t(m_end - m_ptr) >= n || grow(n);
+        }
+
+      public:
+        virtual ~format_sink() = default;
+
+        void
+        put(std::string_view s)
+        {
+            if (!room_for(s.size()))
+            {
+                size_t fits = m_end - m_ptr;
+                m_overflow += s.size() - fits;
+                s = s.substr(0, fits);
+            }
+            std::memcpy(m_ptr, s.data(), s.size());
+            m_ptr += s.size();
+        }
+
+        void
+        fill(char ch, size_t n)
+        {
+            if (!room_for(n))
+            {
+                m_overflow += n - (m_end - m_ptr);
+                n = m_end - m_ptr;
+            }
+            std::memset(m_ptr, ch, n);
+            m_ptr += n;
+        }
+
+        // Run f(first, last) -> to_chars_result straight on the free space;
+        // false, with nothing written, if the result doesn't fit there.
+        template <class F>
+        bool
+        convert(F f)
+        {
+            auto [p, ec] = f(m_ptr, m_end);
+            if (ec != std::errc{})
+            {
+                return false;
+            }
+            m_ptr = p;
+            return true;
+        }
+
+        char *
+        ptr() const
+        {
+            return m_ptr;
+        }
+        size_t
+        overflow() const
+        {
+            return m_overflow;
+        }
+    };
+
+    // The caller's buffer; output past its end is counted and dropped.
+    class fixed_sink : public format_sink
+    {
+        bool
+        grow(size_t) override
+        {
+            return false;
+        }
+
+      public:
+        fixed_sink(char *first, char *last)
+        {
+            m_ptr = first;
+            m_end = last;
+        }
+    };
+
+    // N bytes on the stack, then memory from "mr", which may be an arena.
+    template <size_t N = 256>
+    class format_buffer : public format_sink
+    {
+        char                       m_inline[N];
+        char                      *m_data     = m_inline;
+        size_t                     m_capacity = N;
+        std::pmr::memory_resource *m_mr;
+
+        bool
+        grow(size_t n) override
+        {
+            size_t size     = m_ptr - m_data;
+            size_t capacity = std::max(2 * m_capacity, size + n);
+            char  *p        = static_cast<char *>(m_mr->allocate(capacity, 1));
+            std::memcpy(p, m_data, size);
+            release();
+            m_data     = p;
+            m_capacity = capacity;
+            m_ptr      = p + size;
+            m_end      = p + capacity;
+            return true;
+        }
+
+        void
+        release()
+        {
+            if (m_data != m_inline)
+            {
+                m_mr->deallocate(m_data, m_capacity, 1);
+            }
+        }
+
+      public:
+        explicit format_buffer(std::pmr::memory_resource *mr = std::pmr::new_delete_resource()) : m_mr(mr)
+        {
+            m_ptr = m_inline;
+            m_end = m_inline + N;
+        }
+
+        format_buffer(const format_buffer &) = delete;
+
+        ~format_buffer()
+        {
+            release();
+        }
+
+        std::string_view
+        view() const
+        {
+            return {m_data, size()};
+        }
+        size_t
+        size() const
+        {
+            return m_ptr - m_data;
+        }
+        void
+        clear()
+        {
+            m_ptr = m_data;
+        }
+        const char *
+        c_str()
+        {
+            put({"", 1});
+            --m_ptr;
+            return m_data;
+        }
+    };
+
+    namespace detail
+    {
+        inline void
+        pad(format_sink &out, const format_spec &spec, std::string_view text, bool left)
+        {
+            size_t width = spec.width;
+            if (text.size() >= width)
+            {
+                out.put(text);
+            }
+            else if (left)
+            {
+                out.put(text);
+                out.fill(' ', width - text.size());
+            }
+            else if (spec.zero_pad)
+            {
+                size_t sign = (!text.empty() && text[0] == '-');
+                out.put(text.substr(0, sign));
+                out.fill('0', width - text.size());
+                out.put(text.substr(sign));
+            }
+            else
+            {
+                out.fill(' ', width - text.size());
+                out.put(text);
+            }
+        }
+
+        // f is a to_chars call that never needs more than max_size bytes;
+        // that can be more than fits on the stack (long double, fixed).
+        template <class F>
+        void
+        put_number(format_sink &out, const format_spec &spec, F f, size_t max_size)
+        {
+            if (spec.width == 0 && out.convert(f))
+            {
+                return;
+            }
+            char                    scratch[512];
+            std::unique_ptr<char[]> heap;
+            char                   *first = scratch;
+            std::to_chars_result    r     = f(scratch, scratch + sizeof scratch);
+            if (r.ec != std::errc{})
+            {
+                heap  = std::make_unique_for_overwrite<char[]>(max_size);
+                first = heap.get();
+                r     = f(first, first + max_size);
+                assert(r.ec == std::errc{});
+                if (r.ec != std::errc{})
+                {
+                    return;
+                }
+            }
+            pad(out, spec, {first, r.ptr}, false);
+        }
+
+        template <class T>
+        void
+        put_arg(format_sink &out, const format_spec &spec, const T &arg)
+        {
+            constexpr arg_kind kind = kind_of<std::decay_t<T>>();
+            if constexpr (kind == arg_kind::integer)
+            {
+                bool hex  = spec.type == 'x' || spec.type == 'X';
+                int  base = spec.type == 'o' ? 8 : spec.type == 'b' ? 2 : hex ? 16 : 10;
+                put_number(
+                    out, spec,
+                    [&](char *first, char *last) {
+                        auto r = std::to_chars(first, last, arg, base);
+                        if (spec.type == 'X' && r.ec == std::errc{})
+                        {
+                            // Not toupper(), which would depend on the locale.
+                            std::for_each(first, r.ptr, [](char &c) { c -= ('a' <= c && c <= 'f') ? 'a' - 'A' : 0; });
+                        }
+                        return r;
+                    },
+                    std::numeric_limits<std::decay_t<T>>::digits + 2);
+            }
+            else if constexpr (kind == arg_kind::floating)
+            {
+                auto chars = spec.type == 'f'   ? std::chars_format::fixed
+                             : spec.type == 'e' ? std::chars_format::scientific
+                                                : std::chars_format::general;
+                int  precision = (spec.precision < 0 && spec.type == 'f') ? 6 : spec.precision;
+                // Fixed notation of the largest value, the decimals, a sign and a point.
+                size_t max_size = std::numeric_limits<std::decay_t<T>>::max_exponent10 + std::max(precision, 0) + 8;
+                put_number(
+                    out, spec,
+                    [&](char *first, char *last) {
+                        if (precision >= 0)
+                        {
+                            return std::to_chars(first, last, arg, chars, precision);
+                        }
+                        return spec.type ? std::to_chars(first, last, arg, chars) : std::to_chars(first, last, arg);
+                    },
+                    max_size);
+            }
+            else if constexpr (kind == arg_kind::character)
+            {
+                pad(out, spec, {&arg, 1}, true);
+            }
+            else if constexpr (kind == arg_kind::boolean)
+            {
+                pad(out, spec, arg ? "true" : "false", true);
+            }
+            else
+            {
+                std::string_view s(arg);
+                if (spec.precision >= 0)
+                {
+                    s = s.substr(0, spec.precision);
+                }
+                pad(out, spec, s, true);
+            }
+        }
+
+        inline void
+        put_literal(format_sink &out, std::string_view s, bool escapes)
+        {
+            while (escapes && !s.empty())
+            {
+                size_t i = s.find_first_of("{}");
+                if (i == s.npos)
+                {
+                    break;
+                }
+                out.put(s.substr(0, i + 1)); // keep one brace of the pair
+                s.remove_prefix(i + 2);
+            }
+            out.put(s);
+        }
+    } // namespace detail
+
+    template <class... Args>
+    void
+    format_to(format_sink &out, format_string<Args...> fmt, const Args &...args)
+    {
+        std::string_view str = fmt.get();
+        size_t           pos = 0;
+        size_t           i   = 0;
+        auto             one = [&](const auto &arg) {
+            const format_spec &spec = fmt.spec(i++);
+            detail::put_literal(out, str.substr(pos, spec.begin - pos), fmt.has_escapes());
+            detail::put_arg(out, spec, arg);
+            pos = spec.end;
+        };
+        (one(args), ...);
+        detail::put_literal(out, str.substr(pos), fmt.has_escapes());
+    }
+
+    struct format_to_n_result
+    {
+        char  *out;
+        size_t size; // the full length, as if the buffer were big enough
+    };
+
+    template <class... Args>
+    format_to_n_result
+    format_to(char *first, char *last, format_string<Args...> fmt, const Args &...args)
+    {
+        fixed_sink out(first, last);
+        ex53::format_to(out, fmt, args...);
+        return {out.ptr(), size_t(out.ptr() - first) + out.overflow()};
+    }
+
+    template <class... Args>
+    std::string
+    format(format_string<Args...> fmt, const Args &...args)
+    {
+        format_buffer<> out;
+        ex53::format_to(out, fmt, args...);
+        return std::string(out.view());
+    }
+
+    void
+    test()
+    {
+        int         tuners = 225;
+        const char *where  = "Chicago";
+        assert(ex53::format("There are {} piano tuners in {}", tuners, where) ==
+               "There are 225 piano tuners in Chicago");
+        assert(ex53::format("{{{}}} }}{{", 1) == "{1} }{");
+        assert(ex53::format("{:x} {:X} {:o} {:b} {:05} {:5}|", 255, 255, 8, 5, -42, 42u) ==
+               "ff FF 10 101 -0042    42|");
+        assert(ex53::format("{} {:.3f} {:08.3f} {:e} {:f}", 0.1, 2.0, 3.14159, 1234.5, 1.5) ==
+               "0.1 2.000 0003.142 1.2345e+03 1.500000");
+        assert(ex53::format("{:5}|{}|{}|{}", "ab", std::string("cd"), true, 'c') == "ab   |cd|true|c");
+        // ex53::format("{} {}", 1);     -- doesn't compile: too few arguments
+        // ex53::format("{:f}", 1);      -- doesn't compile: 'f' needs a floating-point argument
+        // ex53::format("{:.2}", 1);     -- doesn't compile: integers don't take a precision
+        assert(ex53::format("{:X} {:.3s}|{:5.2}|", 0xabcdef, "abcdef", std::string("xyz")) == "ABCDEF abc|xy   |");
+
+        // Longer than the stack scratch buffer, with and without a width.
+        std::vector<char> big(6000);
+        auto              to = std::to_chars(big.data(), big.data() + big.size(), 1e4000L, std::chars_format::fixed, 6);
+        assert(to.ec == std::errc{});
+        std::string_view expected(big.data(), to.ptr);
+        assert(ex53::format("{:f}", 1e4000L) == expected);
+        assert(ex53::format("{:100f}", 1e4000L) == expected);
+        assert(ex53::format("{:.100f}", -1e4000L).size() == expected.size() + 1 + 94);
+        char head[10];
+        auto n = format_to(head, head + sizeof head, "{:f}", 1e4000L);
+        assert(n.size == expected.size() && expected.starts_with(std::string_view(head, n.out)));
+
+        char buffer[10];
+        auto r = format_to(buffer, buffer + sizeof buffer, "There are {} piano tuners", tuners);
+        assert(r.out == buffer + 10 && r.size == 26);
+        assert(std::string_view(buffer, 10) == "There are ");
+
+        char                                buf[1000];
+        std::pmr::monotonic_buffer_resource arena(buf, sizeof buf, std::pmr::null_memory_resource());
+        format_buffer<16>                   out(&arena);
+        for (int i = 0; i < 10; ++i)
+        {
+            format_to(out, "{},", i * 11);
+        }
+        assert(std::string_view(out.c_str()) == "0,11,22,33,44,55,66,77,88,99,");
+    }
+    // dex53
+
+    void
+    bench()
+    {
+        constexpr int N      = 1000000;
+        int           tuners = 225;
+        const char   *where  = "Chicago";
+        size_t        total  = 0;
+        auto          time_one = [&](const char *name, auto f) {
+            double s = bench::timed([&] {
+                for (int i = 0; i < N; ++i)
+                {
+                    total += f(tuners + (i & 7));
+                }
+            }).seconds;
+            printf("ex53: %-22s %6.1f ns/call\n", name, s * 1e9 / N);
+        };
+        time_one("ex13 snprintf twice", [&](int n) {
+            return ex13::format("There are %d piano tuners in %s", n, where).size();
+        });
+        time_one("boost::format", [&](int n) {
+            return (boost::format("There are %d piano tuners in %s") % n % where).str().size();
+        });
+#if defined(__cpp_lib_format)
+        time_one("std::format", [&](int n) { return std::format("There are {} piano tuners in {}", n, where).size(); });
+#endif
+        time_one("ex53::format", [&](int n) {
+            return ex53::format("There are {} piano tuners in {}", n, where).size();
+        });
+        time_one("ex53::format_to buffer", [&](int n) {
+            char buffer[64];
+            return format_to(buffer, buffer + sizeof buffer, "There are {} piano tuners in {}", n, where).size;
+        });
+        time_one("ex53::format_buffer", [&](int n) {
+            format_buffer<> out;
+            format_to(out, "There are {} piano tuners in {}", n, where);
+            return out.size();
+        });
+        printf("ex53: (%zu bytes)\n", total);
+    }
+} // namespace ex53
+
+namespace ex54
+{
+    // ex54
+    // Builds responses as an iovec list for one writev. Headers are
+    // written with to_chars into the writer's own text area; bodies, and
+    // any other piece at least ReferenceBytes long, are pointed at rather
+    // than copied, so they must outlive the write.
+    template <size_t TextBytes = 1024, size_t MaxIov = 16, size_t ReferenceBytes = 64>
+    class response_writer
+    {
+        char   m_text[TextBytes];
+        char  *m_ptr = m_text;
+        iovec  m_iov[MaxIov];
+        size_t m_count = 0;
+        size_t m_size  = 0;
+
+        void
+        push(const char *p, size_t n)
+        {
+            if (m_count == MaxIov)
+            {
+                throw std::length_error("response_writer: too many pieces");
+            }
+            m_iov[m_count++] = {const_cast<char *>(p), n};
+            m_size += n;
+        }
+
+        // Extend the last piece if it ends where the new text begins.
+        void
+        text(const char *p, size_t n)
+        {
+            iovec *last = m_count ? &m_iov[m_count - 1] : nullptr;
+            if (last && static_cast<char *>(last->iov_base) + last->iov_len == p)
+            {
+                last->iov_len += n;
+                m_size += n;
+            }
+            else
+            {
+                push(p, n);
+            }
+        }
+
+        char *
+        room(size_t n)
+        {
+            if (size_t(m_text + TextBytes - m_ptr) < n)
+            {
+                throw std::length_error("response_writer: headers too long");
+            }
+            return m_ptr;
+        }
+
+      public:
+        response_writer()                        = default;
+        response_writer(const response_writer &) = delete;
+
+        response_writer &
+        append(std::string_view s)
+        {
+            if (s.size() >= ReferenceBytes)
+            {
+                push(s.data(), s.size());
+            }
+            else
+            {
+                char *p = room(s.size());
+                std::memcpy(p, s.data(), s.size());
+                m_ptr += s.size();
+                text(p, s.size());
+            }
+            return *this;
+        }
+
+        template <class T>
+            requires std::is_integral_v<T>
+        response_writer &
+        append(T value)
+        {
+            char *p      = room(std::numeric_limits<T>::digits10 + 2);
+            auto [e, ec] = std::to_chars(p, m_text + TextBytes, value);
+            m_ptr        = e;
+            text(p, e - p);
+            return *this;
+        }
+
+        response_writer &
+        status(int code, std::string_view reason)
+        {
+            return append("HTTP/1.1 ").append(code).append(" ").append(reason).append("\r\n");
+        }
+
+        template <class T>
+        response_writer &
+        header(std::string_view name, const T &value)
+        {
+            return append(name).append(": ").append(value).append("\r\n");
+        }
+
+        // Content-Length, the blank line, and the body itself by reference.
+        response_writer &
+        body(std::string_view b)
+        {
+            header("Content-Length", b.size()).append("\r\n");
+            if (!b.empty())
+            {
+                push(b.data(), b.size());
+            }
+            return *this;
+        }
+
+        std::span<const iovec>
+        iov() const
+        {
+            return {m_iov, m_count};
+        }
+
+        size_t
+        size() const
+        {
+            return m_size;
+        }
+
+        void
+        clear()
+        {
+            m_ptr   = m_text;
+            m_count = 0;
+            m_size  = 0;
+        }
+
+        // One writev, repeated only if the kernel takes part of it.
+        void
+        write_to(int fd)
+        {
+            iovec *iov   = m_iov;
+            size_t count = m_count;
+            while (count != 0)
+            {
+                ssize_t n = writev(fd, iov, std::min<size_t>(count, IOV_MAX));
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::generic_category(), "writev");
+                }
+                for (; count != 0 && size_t(n) >= iov->iov_len; ++iov, --count)
+                {
+                    n -= iov->iov_len;
+                }
+                if (count != 0)
+                {
+                    iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+                    iov->iov_len -= n;
+                }
+            }
+            clear();
+        }
+    };
+
+    std::string
+    gather(std::span<const iovec> iov)
+    {
+        std::string s;
+        for (const iovec &v : iov)
+        {
+            s.append(static_cast<const char *>(v.iov_base), v.iov_len);
+        }
+        return s;
+    }
+
+    void
+    test()
+    {
+        std::string       body = "hello world";
+        response_writer<> w;
+        w.status(200, "OK").header("Content-Type", "text/plain").header("X-Request-Id", 12345ull).body(body);
+        assert(w.iov().size() == 2 && w.iov().back().iov_base == body.data());
+        assert(gather(w.iov()) == "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nX-Request-Id: 12345\r\n"
+                                  "Content-Length: 11\r\n\r\nhello world");
+        assert(w.size() == gather(w.iov()).size());
+
+        std::string expected = gather(w.iov());
+        int         fd       = open("myfile.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        w.write_to(fd);
+        close(fd);
+        assert(ex52::slurp("myfile.txt") == expected);
+        assert(w.size() == 0);
+
+        // ex35's response, without the allocations.
+        w.append("Content-Length: ").append(body.size()).append("\r\n\r\n").append(body);
+        assert(gather(w.iov()) == "Content-Length: 11\r\n\r\nhello world");
+
+        response_writer<16> tiny;
+        bool                threw = false;
+        try
+        {
+            tiny.status(200, "OK").header("Content-Type", "text/plain");
+        }
+        catch (const std::length_error &)
+        {
+            threw = true;
+        }
+        assert(threw);
+    }
+    // dex54
+
+    void
+    bench()
+    {
+        constexpr int N    = 2000000;
+        int           fd   = open("/dev/null", O_WRONLY);
+        std::string   body = "{\"status\":\"ok\",\"items\":[1,2,3]}";
+        auto          time_one = [&](const char *name, auto f) {
+            double s = bench::timed([&] {
+                for (int i = 0; i < N; ++i)
+                {
+                    f(i);
+                }
+            }).seconds;
+            printf("ex54: %-28s %6.1f ns/response\n", name, s * 1e9 / N);
+        };
+
+        time_one("ex35 concatenation + write", [&](int) {
+            std::string response = "Content-Length: " + std::to_string(body.size()) + "\r\n" + "\r\n" + body;
+            (void)!write(fd, response.data(), response.size());
+        });
+        time_one("ex36 headers + writev", [&](int) {
+            char  buffer[100];
+            char *end    = ex33::write_response_headers(buffer, std::end(buffer), body);
+            iovec iov[2] = {{buffer, size_t(end - buffer)}, {body.data(), body.size()}};
+            (void)!writev(fd, iov, 2);
+        });
+        response_writer<> w;
+        time_one("response_writer + writev", [&](int) {
+            w.append("Content-Length: ").append(body.size()).append("\r\n\r\n").append(body);
+            w.write_to(fd);
+        });
+        response_writer<4096, 64> batch;
+        time_one("response_writer, 16 per call", [&](int i) {
+            batch.status(200, "OK").header("X-Request-Id", i).body(body);
+            if (i % 16 == 15)
+            {
+                batch.write_to(fd);
+            }
+        });
+        batch.write_to(fd);
+        close(fd);
+    }
+} // namespace ex54
+
+namespace ex55
+{
+    // ex55
+    // Values are separated by runs of whitespace and/or commas. Each one
+    // must be a complete from_chars number; anything else is reported in
+    // its from_chars_result, and its value is left 0.
+    inline bool
+    is_separator(char ch)
+    {
+        return ch == ',' || ex50::is_space(ch);
+    }
+
+    // Bit i describes p[i], for 16 bytes.
+    inline unsigned
+    separator_mask16(const char *p)
+    {
+#if defined(__SSE2__)
+        __m128i v   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i t   = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t);
+        __m128i sp  = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+        return _mm_movemask_epi8(_mm_or_si128(ctl, sp));
+#else
+        unsigned m = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            m |= unsigned(is_separator(p[i])) << i;
+        }
+        return m;
+#endif
+    }
+
+    inline unsigned
+    digit_mask16(const char *p)
+    {
+#if defined(__SSE2__)
+        __m128i v = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), _mm_set1_epi8('0'));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(9)), v));
+#else
+        unsigned m = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            m |= unsigned(unsigned(p[i] - '0') < 10) << i;
+        }
+        return m;
+#endif
+    }
+
+    // Skip separators (or, if !Separator, everything else).
+    template <bool Separator>
+    inline const char *
+    scan(const char *p, const char *end)
+    {
+        while (end - p >= 16)
+        {
+            unsigned m = separator_mask16(p);
+            m          = (Separator ? ~m : m) & 0xFFFF;
+            if (m != 0)
+            {
+                return p + std::countr_zero(m);
+            }
+            p += 16;
+        }
+        while (p != end && is_separator(*p) == Separator)
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    inline uint64_t
+    load8(const char *p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v; // little-endian assumed, as on x86 and most ARM
+    }
+
+    inline uint64_t
+    eight_digits(uint64_t v)
+    {
+        v -= 0x3030303030303030;
+        v = (v * 10) + (v >> 8);
+        return ((v & 0x000000FF000000FF) * (100 + (1000000ULL << 32)) +
+                ((v >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32))) >>
+               32;
+    }
+
+    // [p, e) are all digits, at most 19 of them.
+    inline uint64_t
+    parse_digits(const char *p, const char *e)
+    {
+        uint64_t v = 0;
+        for (; e - p >= 8; p += 8)
+        {
+            v = v * 100000000 + eight_digits(load8(p));
+        }
+        for (; p != e; ++p)
+        {
+            v = v * 10 + (*p - '0');
+        }
+        return v;
+    }
+
+    // "limit" is the end of the whole input, so 16 bytes can be loaded
+    // at once even near the end of a short token.
+    inline const char *
+    skip_digits(const char *p, const char *e, const char *limit)
+    {
+        if (limit - p >= 16)
+        {
+            unsigned run = std::countr_zero(~digit_mask16(p));
+            if (run < 16 || e - p <= 16)
+            {
+                return p + std::min<ptrdiff_t>(run, e - p);
+            }
+        }
+        while (p != e && unsigned(*p - '0') < 10)
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    template <class T>
+    std::from_chars_result
+    slow_path(const char *b, const char *e, T &value)
+    {
+        auto r = std::from_chars(b, e, value);
+        if (r.ec == std::errc{} && r.ptr != e)
+        {
+            value = 0;
+            return {b, std::errc::invalid_argument};
+        }
+        return r;
+    }
+
+    inline std::from_chars_result
+    parse_one(const char *b, const char *e, const char *limit, int64_t &value)
+    {
+        bool        neg = (*b == '-');
+        const char *p   = b + neg;
+        const char *d   = skip_digits(p, e, limit);
+        if (d == e && d != p && d - p <= 19)
+        {
+            uint64_t u = parse_digits(p, e);
+            if (u <= uint64_t(std::numeric_limits<int64_t>::max()) + neg)
+            {
+                value = neg ? int64_t(0 - u) : int64_t(u);
+                return {e, std::errc{}};
+            }
+            return {e, std::errc::result_out_of_range};
+        }
+        return slow_path(b, e, value);
+    }
+
+    inline constexpr auto pow10_u64 = [] {
+        std::array<uint64_t, 20> t{};
+        uint64_t                 v = 1;
+        for (auto &x : t)
+        {
+            x = v;
+            v *= 10;
+        }
+        return t;
+    }();
+
+    // Doubles go straight to from_chars, whose libstdc++ implementation is
+    // already an Eisel-Lemire parser; a Clinger fast path in front of it
+    // measured no faster.
+    inline std::from_chars_result
+    parse_one(const char *b, const char *e, const char *, double &value)
+    {
+        return slow_path(b, e, value);
+    }
+
+    struct bulk_parse_result
+    {
+        const char *ptr;    // where parsing stopped: the end, or the first value that didn't fit
+        size_t      count;  // values stored
+        size_t      errors; // of those, how many failed
+    };
+
+    inline uint64_t
+    separator_mask64(const char *p)
+    {
+        return separator_mask16(p) | uint64_t(separator_mask16(p + 16)) << 16 |
+               uint64_t(separator_mask16(p + 32)) << 32 | uint64_t(separator_mask16(p + 48)) << 48;
+    }
+
+    // Calls f(first, last) for each value in [p, end), until f returns
+    // false. Values start where a separator is followed by anything else,
+    // as words do in ex50, so a 64-byte block yields all its starts at once.
+    template <class F>
+    const char *
+    for_each_value(const char *p, const char *end, F f)
+    {
+        uint64_t prev_sep = 1;
+        char     pad[64];
+        for (const char *base = p; base < end; base += 64)
+        {
+            const char *block = base;
+            if (end - base < 64)
+            {
+                std::memset(pad, ' ', sizeof pad);
+                std::memcpy(pad, base, end - base);
+                block = pad;
+            }
+            uint64_t sep    = separator_mask64(block);
+            uint64_t starts = ~sep & ((sep << 1) | prev_sep);
+            prev_sep        = sep >> 63;
+            while (starts != 0)
+            {
+                int i = std::countr_zero(starts);
+                starts &= starts - 1;
+                uint64_t    rest = sep >> i;
+                const char *s    = base + i;
+                const char *e    = rest ? std::min(s + std::countr_zero(rest), end) : scan<false>(base + 64, end);
+                if (!f(s, e))
+                {
+                    return s;
+                }
+            }
+        }
+        return end;
+    }
+
+    inline size_t
+    count_values(const char *p, const char *end)
+    {
+        size_t n = 0;
+        for_each_value(p, end, [&](const char *, const char *) { return ++n; });
+        return n;
+    }
+
+    template <class T>
+    bulk_parse_result
+    parse_serial(const char *p, const char *end, const char *limit, std::span<T> out,
+                 std::span<std::from_chars_result> status)
+    {
+        bulk_parse_result r{p, 0, 0};
+        r.ptr = for_each_value(p, end, [&](const char *b, const char *e) {
+            if (r.count == out.size())
+            {
+                return false;
+            }
+            T    v  = 0;
+            auto fr = parse_one(b, e, limit, v);
+            out[r.count] = v;
+            if (r.count < status.size())
+            {
+                status[r.count] = fr;
+            }
+            r.errors += (fr.ec != std::errc{});
+            r.count += 1;
+            return true;
+        });
+        return r;
+    }
+
+    // Large inputs with enough room in "out" are cut at separators into
+    // one chunk per thread. A counting pass places each chunk's output; it
+    // runs about ten times faster than parsing, so it costs each thread
+    // roughly a tenth of its share on top of the parse itself. On a single
+    // core the split measured 10-30% slower than a serial parse.
+    template <class T>
+    bulk_parse_result
+    parse_numbers(std::span<const char> in, std::span<T> out, std::span<std::from_chars_result> status = {},
+                  unsigned threads = 1)
+    {
+        const char *begin = in.data();
+        const char *end   = begin + in.size();
+        size_t      parts = std::min<size_t>(std::max(threads, 1u), in.size() / (256 << 10) + 1);
+        if (parts == 1)
+        {
+            return parse_serial(begin, end, end, out, status);
+        }
+
+        std::vector<const char *> cuts{begin};
+        for (size_t k = 1; k < parts; ++k)
+        {
+            cuts.push_back(std::max(cuts.back(), scan<true>(scan<false>(begin + in.size() * k / parts, end), end)));
+        }
+        cuts.push_back(end);
+
+        std::vector<size_t>      offsets(parts + 1);
+        std::vector<std::thread> pool;
+        for (size_t k = 0; k < parts; ++k)
+        {
+            pool.emplace_back([&, k] { offsets[k + 1] = count_values(cuts[k], cuts[k + 1]); });
+        }
+        for (auto &t : pool)
+        {
+            t.join();
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        if (offsets.back() > out.size())
+        {
+            return parse_serial(begin, end, end, out, status);
+        }
+
+        std::vector<size_t> errors(parts);
+        pool.clear();
+        for (size_t k = 0; k < parts; ++k)
+        {
+            pool.emplace_back([&, k] {
+                auto st   = status.subspan(std::min(offsets[k], status.size()));
+                errors[k] = parse_serial(cuts[k], cuts[k + 1], end, out.subspan(offsets[k]), st).errors;
+            });
+        }
+        for (auto &t : pool)
+        {
+            t.join();
+        }
+        return {end, offsets.back(), std::accumulate(errors.begin(), errors.end(), size_t(0))};
+    }
+
+    inline bulk_parse_result
+    parse_ints(std::span<const char> in, std::span<int64_t> out, std::span<std::from_chars_result> status = {},
+               unsigned threads = 1)
+    {
+        return parse_numbers(in, out, status, threads);
+    }
+
+    inline bulk_parse_result
+    parse_doubles(std::span<const char> in, std::span<double> out, std::span<std::from_chars_result> status = {},
+                  unsigned threads = 1)
+    {
+        return parse_numbers(in, out, status, threads);
+    }
+
+    // What a from_chars loop over the same tokens would produce.
+    template <class T>
+    void
+    check_against_from_chars(std::string_view text, unsigned threads)
+    {
+        std::vector<T>                      values(text.size() / 2 + 1);
+        std::vector<std::from_chars_result> status(values.size());
+        auto r = parse_numbers(std::span(text), std::span(values), std::span(status), threads);
+        assert(r.ptr == text.data() + text.size());
+
+        size_t      i = 0, errors = 0;
+        const char *p = text.data(), *end = p + text.size();
+        while ((p = scan<true>(p, end)) != end)
+        {
+            const char *e  = scan<false>(p, end);
+            T           v  = 0;
+            auto        fr = std::from_chars(p, e, v);
+            if (fr.ec == std::errc{} && fr.ptr != e)
+            {
+                fr = {p, std::errc::invalid_argument};
+            }
+            assert(status[i].ec == fr.ec && status[i].ptr == fr.ptr);
+            assert(fr.ec != std::errc{} || std::bit_cast<uint64_t>(values[i]) == std::bit_cast<uint64_t>(v));
+            errors += (fr.ec != std::errc{});
+            ++i;
+            p = e;
+        }
+        assert(r.count == i && r.errors == errors);
+    }
+
+    void
+    test()
+    {
+        std::string ints = "12, -7\t9223372036854775807 9223372036854775808,-9223372036854775808 "
+                           "-9223372036854775809 abc 12x - 00000000000000000000042 1234567890123456789 +5 ,,, 0";
+        check_against_from_chars<int64_t>(ints, 1);
+
+        std::string doubles = "0 -0 1.5 .5 5. 1e5 1E-5 2.5e+3 1e400 1e-400 inf nan -nan 3.14159265358979323846 "
+                              "9007199254740993 0.1 123456789.123456789 1e22 1e23 4.9e-324 x1 1.2.3 1e 1e+";
+        check_against_from_chars<double>(doubles, 1);
+
+        std::string big;
+        unsigned    seed = 42;
+        char        buf[32];
+        for (int i = 0; i < 200000; ++i)
+        {
+            seed           = seed * 1103515245 + 12345;
+            int64_t value  = int64_t(seed) * (seed % 7 == 0 ? 1000000007 : 1) - (1 << 30);
+            auto [p, ec]   = std::to_chars(buf, std::end(buf), value);
+            big.append(buf, p).append(i % 10 == 9 ? "\n" : ", ");
+        }
+        check_against_from_chars<int64_t>(big, 1);
+        check_against_from_chars<int64_t>(big, 4);
+
+        big.clear();
+        for (int i = 0; i < 100000; ++i)
+        {
+            seed         = seed * 1103515245 + 12345;
+            double value = (seed % 1000003) / 1000.0 * (seed % 3 == 0 ? 1e-7 : 1.0);
+            int    n     = snprintf(buf, sizeof buf, i % 2 ? "%.17g" : "%g", value);
+            big.append(buf, n).append(" ");
+        }
+        check_against_from_chars<double>(big, 1);
+        check_against_from_chars<double>(big, 3);
+
+        int64_t small[2];
+        auto    r = parse_ints(std::string_view("1 2 3"), small);
+        assert(r.count == 2 && r.ptr[0] == '3' && small[1] == 2);
+    }
+    // dex55
+
+    template <class T>
+    void
+    bench_one(const char *type, const std::string &text, size_t count)
+    {
+        std::vector<T> out(count);
+        auto           time_one = [&](const char *name, auto f) {
+            auto [n, s] = bench::timed(f);
+            printf("ex55: %-7s %-24s %6.2f GB/s %7.1f M values/s (%zu)\n", type, name, text.size() / s / 1e9,
+                   n / s / 1e6, n);
+        };
+        time_one("from_chars loop", [&] {
+            size_t      n = 0;
+            const char *p = text.data(), *end = p + text.size();
+            while ((p = scan<true>(p, end)) != end)
+            {
+                const char *e = scan<false>(p, end);
+                std::from_chars(p, e, out[n++]);
+                p = e;
+            }
+            return n;
+        });
+        time_one("parse_numbers", [&] { return parse_numbers(std::span(text), std::span(out)).count; });
+        // The threaded split pays for a counting pass over the whole input
+        // before any thread starts parsing; time it on its own too.
+        time_one("count_values", [&] { return count_values(text.data(), text.data() + text.size()); });
+        for (unsigned threads : {2u, 4u, 8u})
+        {
+            char name[32];
+            snprintf(name, sizeof name, "parse_numbers, %u threads", threads);
+            time_one(name, [&] { return parse_numbers(std::span(text), std::span(out), {}, threads).count; });
+        }
+    }
+
+    void
+    bench()
+    {
+        constexpr size_t count = 5000000;
+        std::string      ints, doubles;
+        unsigned         seed = 7;
+        char             buf[32];
+        for (size_t i = 0; i < count; ++i)
+        {
+            seed         = seed * 1103515245 + 12345;
+            auto [p, ec] = std::to_chars(buf, std::end(buf), int64_t(seed) * 997);
+            ints.append(buf, p).append(",");
+            p = std::to_chars(buf, std::end(buf), (seed % 100000007) / 1e4).ptr;
+            doubles.append(buf, p).append(",");
+        }
+        bench_one<int64_t>("int64", ints, count);
+        bench_one<double>("double", doubles, count);
+    }
+} // namespace ex55
+
+namespace ex56
+{
+    // ex56
+    // Number of decimal digits in x, without a loop: bit_width gives
+    // log2, times log10(2) ~ 1233/4096 gives the digit count or one less.
+    inline int
+    digits10(uint64_t x)
+    {
+        int t = (std::bit_width(x | 1) * 1233) >> 12;
+        return t + ((x | 1) >= ex55::pow10_u64[t]);
+    }
+
+    inline constexpr auto digit_pairs = [] {
+        std::array<char, 200> t{};
+        for (int i = 0; i < 100; ++i)
+        {
+            t[2 * i]     = char('0' + i / 10);
+            t[2 * i + 1] = char('0' + i % 10);
+        }
+        return t;
+    }();
+
+    // Writes exactly digits10(x) characters ending at "end".
+    inline void
+    write_digits(char *end, uint64_t x)
+    {
+        while (x >= 100)
+        {
+            end -= 2;
+            std::memcpy(end, &digit_pairs[x % 100 * 2], 2);
+            x /= 100;
+        }
+        if (x >= 10)
+        {
+            std::memcpy(end - 2, &digit_pairs[x * 2], 2);
+        }
+        else
+        {
+            end[-1] = char('0' + x);
+        }
+    }
+
+    template <class T>
+        requires std::is_integral_v<T>
+    inline char *
+    write_value(char *p, T value)
+    {
+        uint64_t u = value;
+        if constexpr (std::is_signed_v<T>)
+        {
+            *p = '-';
+            p += (value < 0);
+            u = (value < 0) ? 0 - u : u;
+        }
+        p += digits10(u);
+        write_digits(p, u);
+        return p;
+    }
+
+    // Shortest round-trip form for T itself (a float is not widened to
+    // double first, so 0.1f stays "0.1"); libstdc++'s to_chars is Ryu-based.
+    template <class T>
+        requires std::is_floating_point_v<T>
+    inline char *
+    write_value(char *p, T value)
+    {
+        return std::to_chars(p, p + 32, value).ptr;
+    }
+
+    template <class T>
+    inline constexpr size_t max_chars = std::is_floating_point_v<T> ? 32 : std::numeric_limits<T>::digits10 + 2;
+
+    struct format_column_result
+    {
+        char  *ptr;   // one past the last byte written
+        size_t count; // values written; only whole values are written
+    };
+
+    // Writes each value followed by the separator (none after the last).
+    template <class T>
+    format_column_result
+    format_column(std::span<const T> values, std::string_view sep, std::span<char> out)
+    {
+        char  *p     = out.data();
+        char  *end   = p + out.size();
+        size_t room  = max_chars<T> + sep.size();
+        size_t count = 0;
+        for (; count != values.size(); ++count)
+        {
+            if (size_t(end - p) < room)
+            {
+                char   scratch[max_chars<T>];
+                size_t n = write_value(scratch, values[count]) - scratch;
+                if (size_t(end - p) < n + (count ? sep.size() : 0))
+                {
+                    break;
+                }
+                if (count)
+                {
+                    std::memcpy(p, sep.data(), sep.size());
+                    p += sep.size();
+                }
+                std::memcpy(p, scratch, n);
+                p += n;
+                continue;
+            }
+            if (count)
+            {
+                std::memcpy(p, sep.data(), sep.size());
+                p += sep.size();
+            }
+            p = write_value(p, values[count]);
+        }
+        return {p, count};
+    }
+
+    template <class T>
+    void
+    check(std::span<const T> values, const char *sep)
+    {
+        std::string expected;
+        for (const T &v : values)
+        {
+            char buffer[100];
+            auto r = std::to_chars(buffer, std::end(buffer), v);
+            expected.append(expected.empty() ? "" : sep).append(buffer, r.ptr);
+        }
+        std::string out(expected.size() + 50, '\0');
+        auto        r = format_column(values, sep, std::span(out));
+        assert(r.count == values.size() && std::string_view(out.data(), r.ptr) == expected);
+
+        // Too small: only whole values come out.
+        r = format_column(values, sep, std::span(out.data(), expected.size() - 1));
+        assert(r.count == values.size() - 1 && expected.starts_with(std::string_view(out.data(), r.ptr)));
+    }
+
+    void
+    test()
+    {
+        for (uint64_t x = 1, d = 1; d <= 20; x *= 10, ++d)
+        {
+            assert(digits10(x - 1) == int(d - 1 + (x == 1)) && digits10(x) == int(d));
+        }
+        std::vector<int64_t> ints = {0, 7, -7, 10, 99, -100, 123456789, std::numeric_limits<int64_t>::max(),
+                                     std::numeric_limits<int64_t>::min()};
+        check<int64_t>(ints, ",");
+        std::vector<int32_t> small = {std::numeric_limits<int32_t>::min(), -1, 42};
+        check<int32_t>(small, ", ");
+        std::vector<uint64_t> big = {0, std::numeric_limits<uint64_t>::max()};
+        check<uint64_t>(big, "\t");
+        std::vector<double> doubles = {0.0, -0.0, 0.1, 1e300, -2.2250738585072014e-308, 5e-324, 1.0 / 3, 123456.0};
+        check<double>(doubles, "\n");
+        std::vector<float> floats = {0.1f, -1.5f, 1.0f / 3, 3.4028235e38f, 1e-45f};
+        check<float>(floats, " ");
+        char buffer[max_chars<float>];
+        assert(std::string_view(buffer, write_value(buffer, 0.1f)) == "0.1");
+    }
+    // dex56
+
+    template <class T>
+    void
+    bench_one(const char *type, const std::vector<T> &values, const char *printf_format)
+    {
+        std::vector<char> out(values.size() * (max_chars<T> + 1));
+        auto              time_one = [&](const char *name, auto f) {
+            auto [p, s] = bench::timed(f);
+            size_t n    = p - out.data();
+            printf("ex56: %-6s %-20s %6.2f GB/s %7.1f M values/s\n", type, name, n / s / 1e9, values.size() / s / 1e6);
+        };
+        time_one("snprintf loop", [&] {
+            char *p = out.data();
+            for (const T &v : values)
+            {
+                char buffer[100];
+                int  n = snprintf(buffer, sizeof buffer, printf_format, v);
+                std::memcpy(p, buffer, n);
+                p += n;
+                *p++ = ',';
+            }
+            return p;
+        });
+        time_one("to_chars loop", [&] {
+            char *p = out.data();
+            for (const T &v : values)
+            {
+                char buffer[100];
+                auto r = std::to_chars(buffer, std::end(buffer), v);
+                std::memcpy(p, buffer, r.ptr - buffer);
+                p += r.ptr - buffer;
+                *p++ = ',';
+            }
+            return p;
+        });
+        time_one("format_column", [&] { return format_column(std::span(values), ",", std::span(out)).ptr; });
+    }
+
+    void
+    bench()
+    {
+        constexpr size_t     count = 5000000;
+        std::vector<int64_t> ints(count);
+        std::vector<double>  doubles(count);
+        unsigned             seed = 11;
+        for (size_t i = 0; i < count; ++i)
+        {
+            seed       = seed * 1103515245 + 12345;
+            ints[i]    = int64_t(seed >> (seed % 24)) - (1 << 20);
+            doubles[i] = (seed % 1000003) / 997.0;
+        }
+        bench_one<int64_t>("int64", ints, "%ld");
+        bench_one<double>("double", doubles, "%.17g");
+    }
+} // namespace ex56
+
+namespace ex57
+{
+    // ex57
+    // Drop-in replacements for std::stoi and friends: leading whitespace
+    // is skipped, a '+' sign and (for base 16 or 0) a "0x" prefix are
+    // accepted, trailing text is allowed and reported through *idx, and
+    // failures throw std::invalid_argument or std::out_of_range. Unlike
+    // the std:: versions they take a string_view, never allocate, and
+    // never consult the locale: "3.14" is 3.14 even under en_DK (ex42).
+    // Hexadecimal floating-point input is not accepted.
+    template <class T>
+    std::expected<T, std::errc>
+    try_parse(std::string_view s, size_t *idx = nullptr, int base = 10)
+    {
+        const char *first = s.data();
+        const char *last  = first + s.size();
+        const char *p     = first;
+        while (p != last && ex50::is_space(*p))
+        {
+            ++p;
+        }
+        bool neg = false;
+        if (p != last && (*p == '+' || *p == '-'))
+        {
+            neg = (*p == '-');
+            ++p;
+        }
+        if (p != last && (*p == '+' || *p == '-'))
+        {
+            return std::unexpected(std::errc::invalid_argument); // from_chars would take a second sign
+        }
+        T                      value{};
+        std::from_chars_result r;
+        if constexpr (std::is_integral_v<T>)
+        {
+            bool hex_prefix = last - p >= 3 && p[0] == '0' && (p[1] | 0x20) == 'x' &&
+                              (unsigned(p[2] - '0') < 10 || unsigned((p[2] | 0x20) - 'a') < 6);
+            if (base == 0)
+            {
+                base = hex_prefix ? 16 : (last - p >= 2 && p[0] == '0') ? 8 : 10;
+            }
+            if (base == 16 && hex_prefix)
+            {
+                p += 2;
+            }
+            using U = std::make_unsigned_t<T>;
+            U u;
+            r = std::from_chars(p, last, u, base);
+            if (r.ec == std::errc{})
+            {
+                U limit = U(std::numeric_limits<T>::max()) + (neg && std::is_signed_v<T>);
+                if (u > limit || (neg && std::is_unsigned_v<T> && u != 0))
+                {
+                    r.ec = std::errc::result_out_of_range;
+                }
+                value = neg ? T(U(0) - u) : T(u);
+            }
+        }
+        else
+        {
+            r     = std::from_chars(p, last, value);
+            value = neg ? -value : value;
+        }
+        if (r.ec != std::errc{})
+        {
+            return std::unexpected(r.ec);
+        }
+        if (idx)
+        {
+            *idx = r.ptr - first;
+        }
+        return value;
+    }
+
+    template <class T>
+    T
+    parse(std::string_view s, size_t *idx = nullptr, int base = 10)
+    {
+        auto result = try_parse<T>(s, idx, base);
+        if (!result)
+        {
+            if (result.error() == std::errc::result_out_of_range)
+            {
+                throw std::out_of_range("ex57::parse");
+            }
+            throw std::invalid_argument("ex57::parse");
+        }
+        return *result;
+    }
+
+    inline int
+    stoi(std::string_view s, size_t *idx = nullptr, int base = 10)
+    {
+        return parse<int>(s, idx, base);
+    }
+    inline long
+    stol(std::string_view s, size_t *idx = nullptr, int base = 10)
+    {
+        return parse<long>(s, idx, base);
+    }
+    inline long long
+    stoll(std::string_view s, size_t *idx = nullptr, int base = 10)
+    {
+        return parse<long long>(s, idx, base);
+    }
+    inline float
+    stof(std::string_view s, size_t *idx = nullptr)
+    {
+        return parse<float>(s, idx);
+    }
+    inline double
+    stod(std::string_view s, size_t *idx = nullptr)
+    {
+        return parse<double>(s, idx);
+    }
+
+    template <class F>
+    std::string
+    error_of(F f)
+    {
+        try
+        {
+            f();
+        }
+        catch (const std::out_of_range &)
+        {
+            return "out_of_range";
+        }
+        catch (const std::invalid_argument &)
+        {
+            return "invalid_argument";
+        }
+        return "";
+    }
+
+    void
+    test()
+    {
+        // Agrees with std::stoi and std::stod in the "C" locale...
+        for (std::string s : {"42", "  -17abc", "+5", "0", "-0", "2147483647", "  2147483648", "-2147483648", "abc",
+                              "", " ", "+", "-", "0x1f", "007", "\t\n12 34", "--5", "+-5", "-+5"})
+        {
+            for (int base : {10, 16, 8, 0})
+            {
+                size_t i1 = 99, i2 = 99;
+                int    v1 = 0, v2 = 0;
+                auto   e1 = error_of([&] { v1 = std::stoi(s, &i1, base); });
+                auto   e2 = error_of([&] { v2 = ex57::stoi(s, &i2, base); });
+                assert(e1 == e2 && v1 == v2 && i1 == i2);
+            }
+        }
+        for (std::string s :
+             {"3.14", " -2.5e3x", "+1", "1e400", ".5", "5.", "inf", "-nan", "abc", "1e-5", "--5", "+-5", "-+5"})
+        {
+            size_t i1 = 99, i2 = 99;
+            double v1 = 0, v2 = 0;
+            auto   e1 = error_of([&] { v1 = std::stod(s, &i1); });
+            auto   e2 = error_of([&] { v2 = ex57::stod(s, &i2); });
+            assert(e1 == e2 && i1 == i2 && (v1 == v2 || (v1 != v1 && v2 != v2)));
+        }
+        assert(error_of([] { ex57::stol("-1", nullptr, 10); }).empty());
+        assert(ex57::try_parse<unsigned>("-1").error() == std::errc::result_out_of_range);
+        assert(ex57::try_parse<short>("32768").error() == std::errc::result_out_of_range);
+        assert(ex57::try_parse<double>("x").error() == std::errc::invalid_argument);
+        assert(*ex57::try_parse<long long>("-9223372036854775808") == std::numeric_limits<long long>::min());
+
+        // ...but not with any other locale.
+        const char *old = std::setlocale(LC_NUMERIC, nullptr);
+        std::string saved(old ? old : "C");
+        for (const char *name : {"de_DE.UTF-8", "en_DK.UTF-8", "fr_FR.UTF-8"})
+        {
+            if (std::setlocale(LC_NUMERIC, name))
+            {
+                assert(ex57::stod("3.14") == 3.14);
+            }
+        }
+        std::setlocale(LC_NUMERIC, saved.c_str());
+    }
+    // dex57
+
+    void
+    bench()
+    {
+        constexpr int            N = 2000000;
+        std::vector<std::string> inputs;
+        std::string              joined;
+        unsigned                 seed = 5;
+        char                     buf[32];
+        for (int i = 0; i < 1000; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            int n = snprintf(buf, sizeof buf, "%.6f", (seed % 100000007) / 1e3);
+            inputs.emplace_back(buf, n);
+            joined.append(buf, n).append(" ");
+        }
+        double sum      = 0;
+        auto   time_one = [&](const char *name, auto f) {
+            double s = bench::timed(f).seconds;
+            printf("ex57: %-22s %6.1f ns/value\n", name, s * 1e9 / N);
+        };
+        time_one("std::stod", [&] {
+            for (int i = 0; i < N; ++i)
+            {
+                sum += std::stod(inputs[i % 1000]);
+            }
+        });
+        time_one("std::istringstream", [&] {
+            std::istringstream iss;
+            for (int i = 0; i < N; i += 1000)
+            {
+                iss.clear();
+                iss.str(joined);
+                for (double d; iss >> d;)
+                {
+                    sum += d;
+                }
+            }
+        });
+        time_one("ex57::stod", [&] {
+            for (int i = 0; i < N; ++i)
+            {
+                sum += ex57::stod(inputs[i % 1000]);
+            }
+        });
+        printf("ex57: (sum %g)\n", sum);
+    }
+} // namespace ex57
+
+namespace ex58
+{
+    void
+    process(std::string_view)
+    {
+    }
+    void
+    loop()
+    {
+        // ex58
+        fastio::line_reader in(STDIN_FILENO);
+        std::string_view    line;
+        while (getline(in, line))
+        {
+            // automatically chomps trailing newlines, as in ex45
+            process(line);
+        }
+        // dex58
+    }
+
+    std::vector<std::string>
+    lines_of(const char *path, size_t buffer_size)
+    {
+        int                      fd = open(path, O_RDONLY);
+        fastio::line_reader      in(fd, buffer_size);
+        std::vector<std::string> result;
+        for (std::string_view line : in)
+        {
+            result.emplace_back(line);
+        }
+        close(fd);
+        return result;
+    }
+
+    void
+    test()
+    {
+        const char *path = "myfile.txt";
+        std::vector<std::string> texts = {"", "\n", "one", "one\n", "one\ntwo", "\n\nthree\r\n\nlast line, no newline",
+                                          std::string(10000, 'x') + "\n" + std::string(5000, 'y')};
+        for (const std::string &text : texts)
+        {
+            {
+                std::ofstream(path) << text;
+            }
+            std::vector<std::string> expected;
+            std::ifstream            fs(path);
+            for (std::string line; std::getline(fs, line);)
+            {
+                expected.push_back(line);
+            }
+            for (size_t buffer_size : {1, 7, 4096, 1 << 20})
+            {
+                assert(lines_of(path, buffer_size) == expected);
+            }
+        }
+    }
+
+    void
+    bench()
+    {
+        const char *path = "ex58.dat";
+        {
+            ex52::buffered_writer w(path);
+            std::string_view      words = "left right up down forward backward sideways";
+            unsigned              seed  = 3;
+            for (int i = 0; i < 500000; ++i)
+            {
+                seed = seed * 1103515245 + 12345;
+                w.write(words.data(), 8 + (seed >> 8) % (words.size() - 7));
+                w.write("\n");
+            }
+        }
+        int saved = dup(STDIN_FILENO);
+        int fd    = open(path, O_RDONLY);
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+        struct stat st;
+        fstat(STDIN_FILENO, &st);
+
+        auto time_one = [&](const char *name, auto f) {
+            fseek(stdin, 0, SEEK_SET);
+            lseek(STDIN_FILENO, 0, SEEK_SET);
+            std::cin.clear();
+            auto [lines, s] = bench::timed(f);
+            printf("ex58: %-38s %6.2f GB/s (%zu lines)\n", name, st.st_size / s / 1e9, lines);
+        };
+        auto with_getline = [] {
+            size_t      n = 0;
+            std::string line;
+            while (std::getline(std::cin, line))
+            {
+                n += 1;
+            }
+            return n;
+        };
+        time_one("std::getline", with_getline);
+        std::ios_base::sync_with_stdio(false);
+        time_one("std::getline, sync_with_stdio(false)", with_getline);
+        std::ios_base::sync_with_stdio(true);
+        time_one("fastio::line_reader", [] {
+            size_t              n = 0;
+            fastio::line_reader in(STDIN_FILENO);
+            std::string_view    line;
+            while (getline(in, line))
+            {
+                n += 1;
+            }
+            return n;
+        });
+
+        dup2(saved, STDIN_FILENO);
+        close(saved);
+        std::cin.clear();
+        unlink(path);
+    }
+} // namespace ex58
+
+namespace ex59
+{
+    // ex59
+    // Bit i set if p[i] is whitespace, as ex50 classifies it; 16 bytes.
+    inline unsigned
+    space_mask16(const char *p)
+    {
+#if defined(__SSE2__)
+        __m128i v   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i t   = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t);
+        return _mm_movemask_epi8(_mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+#else
+        unsigned m = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            m |= unsigned(ex50::is_space(p[i])) << i;
+        }
+        return m;
+#endif
+    }
+
+    // Pulls blocks from the stream's buffer with sgetn and cuts them into
+    // whitespace-separated tokens. It reads ahead, so where the stream is
+    // left after the last token is unspecified.
+    class token_source
+    {
+        std::istream           &m_in;
+        std::unique_ptr<char[]> m_buffer;
+        size_t                  m_capacity;
+        char                   *m_begin;
+        char                   *m_end;
+        bool                    m_eof = false;
+
+        template <bool Space>
+        char *
+        skip(char *p) const
+        {
+            while (m_end - p >= 16)
+            {
+                unsigned m = space_mask16(p);
+                m          = (Space ? ~m : m) & 0xFFFF;
+                if (m != 0)
+                {
+                    return p + std::countr_zero(m);
+                }
+                p += 16;
+            }
+            while (p != m_end && ex50::is_space(*p) == Space)
+            {
+                ++p;
+            }
+            return p;
+        }
+
+        void
+        refill()
+        {
+            size_t kept = m_end - m_begin;
+            if (kept == m_capacity)
+            {
+                auto bigger = std::make_unique_for_overwrite<char[]>(2 * m_capacity);
+                std::memcpy(bigger.get(), m_begin, kept);
+                m_buffer = std::move(bigger);
+                m_capacity *= 2;
+            }
+            else
+            {
+                std::memmove(m_buffer.get(), m_begin, kept);
+            }
+            m_begin           = m_buffer.get();
+            m_end             = m_begin + kept;
+            std::streamsize n = m_in.rdbuf() ? m_in.rdbuf()->sgetn(m_end, m_capacity - kept) : 0;
+            m_eof             = (n <= 0);
+            m_end += std::max<std::streamsize>(n, 0);
+        }
+
+      public:
+        explicit token_source(std::istream &in, size_t buffer_size)
+            : m_in(in), m_buffer(std::make_unique_for_overwrite<char[]>(std::max<size_t>(buffer_size, 1))),
+              m_capacity(std::max<size_t>(buffer_size, 1)), m_begin(m_buffer.get()), m_end(m_begin)
+        {
+        }
+
+        // The view lasts until the next call.
+        bool
+        next(std::string_view &token)
+        {
+            size_t scanned = 0; // of a token cut short by the buffer's end
+            while (true)
+            {
+                m_begin = skip<true>(m_begin);
+                char *e = skip<false>(m_begin + scanned);
+                if (e != m_end || (m_eof && m_begin != m_end))
+                {
+                    token   = std::string_view(m_begin, e - m_begin);
+                    m_begin = e;
+                    return true;
+                }
+                if (m_eof)
+                {
+                    m_in.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+                    return false;
+                }
+                scanned = e - m_begin;
+                refill();
+            }
+        }
+
+        void
+        fail()
+        {
+            m_in.setstate(std::ios_base::failbit);
+        }
+    };
+
+    // Same interface as ex46::streamer<T>. T may be std::string,
+    // std::string_view (pointing into the buffer), or an arithmetic type
+    // parsed with from_chars. As with istream_iterator, a token that
+    // doesn't parse ends the range, a leading '+' is accepted, and "inf"
+    // or "nan" is not a double. Unlike it, a token must parse whole, so
+    // "3x" ends the range instead of yielding 3.
+    template <class T>
+    struct streamer
+    {
+        mutable token_source m_source;
+
+        explicit streamer(std::istream &in, size_t buffer_size = 1 << 16) : m_source(in, buffer_size)
+        {
+        }
+
+        class iterator
+        {
+            token_source *m_source = nullptr;
+            T             m_value{};
+
+            // from_chars, but with istream's idea of a number: one leading
+            // '+' is allowed, and "inf" and "nan" are not numbers.
+            bool
+            parse(std::string_view token)
+            {
+                const char *p = token.data();
+                const char *e = p + token.size();
+                if (p != e && *p == '+')
+                {
+                    ++p;
+                    if (p != e && *p == '-')
+                    {
+                        return false;
+                    }
+                }
+                if constexpr (std::is_floating_point_v<T>)
+                {
+                    const char *q = p + (p != e && *p == '-');
+                    if (q == e || !((*q >= '0' && *q <= '9') || *q == '.'))
+                    {
+                        return false;
+                    }
+                }
+                auto [end, ec] = std::from_chars(p, e, m_value);
+                return ec == std::errc{} && end == e;
+            }
+
+          public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = T;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const T *;
+            using reference         = const T &;
+
+            iterator() = default;
+            explicit iterator(token_source *s) : m_source(s)
+            {
+                ++*this;
+            }
+
+            reference
+            operator*() const
+            {
+                return m_value;
+            }
+            pointer
+            operator->() const
+            {
+                return &m_value;
+            }
+            iterator &
+            operator++()
+            {
+                std::string_view token;
+                if (!m_source->next(token))
+                {
+                    m_source = nullptr;
+                }
+                else if constexpr (std::is_arithmetic_v<T>)
+                {
+                    if (!parse(token))
+                    {
+                        m_source->fail();
+                        m_source = nullptr;
+                    }
+                }
+                else
+                {
+                    m_value = T(token);
+                }
+                return *this;
+            }
+            void
+            operator++(int)
+            {
+                ++*this;
+            }
+            bool
+            operator==(std::default_sentinel_t) const
+            {
+                return m_source == nullptr;
+            }
+        };
+
+        auto
+        begin() const
+        {
+            return iterator(&m_source);
+        }
+        auto
+        end() const
+        {
+            return std::default_sentinel;
+        }
+    };
+
+    template <class T, template <class> class Streamer>
+    std::vector<T>
+    collect(const std::string &text, auto... args)
+    {
+        std::istringstream iss(text);
+        std::vector<T>     result;
+        for (auto value : Streamer<T>(iss, args...))
+        {
+            result.push_back(value);
+        }
+        return result;
+    }
+
+    void
+    test()
+    {
+        std::vector<std::string> inputs = {"", "   ", "1", " 1 2\n 3\t-4  5 ", "7 8 x 9", std::string(100, ' ') + "42",
+                                           "123456789 " + std::string(40, '9') + " 5",
+                                           "1 +5 6", "1 +-5 6", "1 inf 2", "-inf 3", "nan", "+.5 2", "+"};
+        for (const std::string &text : inputs)
+        {
+            for (size_t buffer_size : {1, 5, 1 << 16})
+            {
+                assert((collect<int, streamer>(text, buffer_size) == collect<int, ex46::streamer>(text)));
+                assert((collect<std::string, streamer>(text, buffer_size) ==
+                        collect<std::string, ex46::streamer>(text)));
+                assert((collect<double, streamer>(text, buffer_size) == collect<double, ex46::streamer>(text)));
+            }
+        }
+
+        // ex47, unchanged but for the namespace.
+        std::istringstream in("1 2 3");
+        std::string        out;
+        for (auto value : streamer<int>(in))
+        {
+            out += std::to_string(2 * value) + " ";
+        }
+        assert(out == "2 4 6 " && in.eof());
+    }
+    // dex59
+
+    void
+    bench()
+    {
+        std::string text;
+        unsigned    seed = 9;
+        char        buf[32];
+        for (int i = 0; i < 3000000; ++i)
+        {
+            seed         = seed * 1103515245 + 12345;
+            auto [p, ec] = std::to_chars(buf, std::end(buf), int(seed >> 4) - (1 << 26));
+            text.append(buf, p).append(i % 8 == 7 ? "\n" : " ");
+        }
+        auto time_one = [&](const char *name, auto f) {
+            std::istringstream in(text);
+            auto [n, s] = bench::timed([&] { return f(in); });
+            printf("ex59: %-28s %6.2f GB/s (%lld)\n", name, text.size() / s / 1e9, n);
+        };
+        time_one("ex46::streamer<int>", [](std::istream &in) {
+            long long sum = 0;
+            for (auto value : ex46::streamer<int>(in))
+            {
+                sum += value;
+            }
+            return sum;
+        });
+        time_one("ex59::streamer<int>", [](std::istream &in) {
+            long long sum = 0;
+            for (auto value : streamer<int>(in))
+            {
+                sum += value;
+            }
+            return sum;
+        });
+        time_one("ex46::streamer<string>", [](std::istream &in) {
+            long long n = 0;
+            for (const auto &word : ex46::streamer<std::string>(in))
+            {
+                n += word.size();
+            }
+            return n;
+        });
+        time_one("ex59::streamer<string_view>", [](std::istream &in) {
+            long long n = 0;
+            for (auto word : streamer<std::string_view>(in))
+            {
+                n += word.size();
+            }
+            return n;
+        });
+    }
+} // namespace ex59
+
+namespace ex60
+{
+    // ex60
+    // A policy names the quote characters, the bytes that need escaping
+    // (specials, plus all control characters if "controls"), and how to
+    // escape one of them into at most max_escape bytes.
+    struct backslash_policy // exactly what ex29's do_quote produces
+    {
+        static constexpr char             quote      = '"';
+        static constexpr std::string_view specials   = "\"";
+        static constexpr bool             controls   = false;
+        static constexpr size_t           max_escape = 2;
+        static char *
+        escape(char ch, char *out)
+        {
+            out[0] = '\\';
+            out[1] = ch;
+            return out + 2;
+        }
+    };
+
+    struct csv_policy // RFC 4180: double the quotes
+    {
+        static constexpr char             quote      = '"';
+        static constexpr std::string_view specials   = "\"";
+        static constexpr bool             controls   = false;
+        static constexpr size_t           max_escape = 2;
+        static char *
+        escape(char, char *out)
+        {
+            out[0] = out[1] = '"';
+            return out + 2;
+        }
+    };
+
+    struct json_policy
+    {
+        static constexpr char             quote      = '"';
+        static constexpr std::string_view specials   = "\"\\";
+        static constexpr bool             controls   = true;
+        static constexpr size_t           max_escape = 6;
+        static char *
+        escape(char ch, char *out)
+        {
+            const char *shortcut = nullptr;
+            switch (ch)
+            {
+            case '"':
+                shortcut = "\\\"";
+                break;
+            case '\\':
+                shortcut = "\\\\";
+                break;
+            case '\b':
+                shortcut = "\\b";
+                break;
+            case '\f':
+                shortcut = "\\f";
+                break;
+            case '\n':
+                shortcut = "\\n";
+                break;
+            case '\r':
+                shortcut = "\\r";
+                break;
+            case '\t':
+                shortcut = "\\t";
+                break;
+            }
+            if (shortcut)
+            {
+                std::memcpy(out, shortcut, 2);
+                return out + 2;
+            }
+            static constexpr char hex[] = "0123456789abcdef";
+            std::memcpy(out, "\\u00", 4);
+            out[4] = hex[(ch >> 4) & 0xF];
+            out[5] = hex[ch & 0xF];
+            return out + 6;
+        }
+    };
+
+    struct shell_policy // POSIX sh single quotes: ' becomes '\''
+    {
+        static constexpr char             quote      = '\'';
+        static constexpr std::string_view specials   = "'";
+        static constexpr bool             controls   = false;
+        static constexpr size_t           max_escape = 4;
+        static char *
+        escape(char, char *out)
+        {
+            std::memcpy(out, "'\\''", 4);
+            return out + 4;
+        }
+    };
+
+    template <class Policy>
+    inline bool
+    needs_escape(char ch)
+    {
+        return Policy::specials.find(ch) != Policy::specials.npos || (Policy::controls && (unsigned char)ch < 0x20);
+    }
+
+    // Bit i set if p[i] needs escaping; 64 bytes.
+    template <class Policy>
+    inline uint64_t
+    special_mask64(const char *p)
+    {
+        uint64_t m = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+#if defined(__SSE2__)
+            __m128i v   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+            __m128i hit = _mm_setzero_si128();
+            for (char ch : Policy::specials)
+            {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(ch)));
+            }
+            if constexpr (Policy::controls)
+            {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v));
+            }
+            m |= uint64_t(uint16_t(_mm_movemask_epi8(hit))) << (16 * i);
+#else
+            for (int j = 0; j < 16; ++j)
+            {
+                m |= uint64_t(needs_escape<Policy>(p[16 * i + j])) << (16 * i + j);
+            }
+#endif
+        }
+        return m;
+    }
+
+    template <class Policy>
+    constexpr size_t
+    max_escaped_size(size_t n)
+    {
+        return n * Policy::max_escape + 2;
+    }
+
+    // Escapes "in" without the surrounding quotes. Clean runs are copied
+    // whole; "out" needs room for n * Policy::max_escape bytes.
+    template <class Policy>
+    char *
+    escape_body(std::string_view in, char *out)
+    {
+        const char *p   = in.data();
+        const char *end = p + in.size();
+        for (; end - p >= 64; p += 64)
+        {
+            uint64_t m    = special_mask64<Policy>(p);
+            size_t   done = 0;
+            for (; m != 0; m &= m - 1)
+            {
+                size_t i = std::countr_zero(m);
+                std::memcpy(out, p + done, i - done);
+                out  = Policy::escape(p[i], out + (i - done));
+                done = i + 1;
+            }
+            std::memcpy(out, p + done, 64 - done);
+            out += 64 - done;
+        }
+        for (; p != end; ++p)
+        {
+            if (needs_escape<Policy>(*p))
+            {
+                out = Policy::escape(*p, out);
+            }
+            else
+            {
+                *out++ = *p;
+            }
+        }
+        return out;
+    }
+
+    template <class Policy>
+    char *
+    escape_to(std::string_view in, char *out)
+    {
+        *out++ = Policy::quote;
+        out    = escape_body<Policy>(in, out);
+        *out++ = Policy::quote;
+        return out;
+    }
+
+    template <class Policy>
+    void
+    append_escaped(std::string &s, std::string_view in)
+    {
+        size_t old = s.size();
+        s.resize(old + max_escaped_size<Policy>(in.size()));
+        s.resize(escape_to<Policy>(in, s.data() + old) - s.data());
+    }
+
+    template <class Policy>
+    std::string
+    escape(std::string_view in)
+    {
+        std::string s;
+        append_escaped<Policy>(s, in);
+        return s;
+    }
+
+    // Like ex29's quoted, but escaping a slice at a time into a local
+    // buffer and handing each to the stream with one write().
+    template <class Policy>
+    struct escaped
+    {
+        std::string_view m_view;
+    };
+
+    template <class Policy>
+    std::ostream &
+    operator<<(std::ostream &os, escaped<Policy> q)
+    {
+        constexpr size_t slice = 4096;
+        char             buffer[slice * Policy::max_escape + 2];
+        std::string_view in = q.m_view;
+        char            *p  = buffer;
+        *p++                = Policy::quote;
+        do
+        {
+            p = escape_body<Policy>(in.substr(0, slice), p);
+            in.remove_prefix(std::min(slice, in.size()));
+            if (in.empty())
+            {
+                *p++ = Policy::quote;
+            }
+            os.write(buffer, p - buffer);
+            p = buffer;
+        } while (!in.empty());
+        return os;
+    }
+
+    std::string
+    ex29_quote(std::string_view s)
+    {
+        std::string result;
+        ex29::do_quote(s.begin(), s.end(), std::back_inserter(result));
+        return result;
+    }
+
+    void
+    test()
+    {
+        std::string mixed = "I said \"hello\".\n\tC:\\path 'quoted' \x01 end";
+        for (int i = 0; i < 7; ++i)
+        {
+            mixed += mixed; // long enough to take the 64-byte path
+        }
+        for (std::string_view s : {std::string_view("I said \"hello\"."), std::string_view(mixed), std::string_view()})
+        {
+            assert(escape<backslash_policy>(s) == ex29_quote(s));
+            std::ostringstream oss;
+            oss << escaped<backslash_policy>{s};
+            assert(oss.str() == ex29_quote(s));
+        }
+        assert(escape<csv_policy>("a \"b\", c") == "\"a \"\"b\"\", c\"");
+        assert(escape<json_policy>("q\" b\\ \n\t\x01\x1f") == "\"q\\\" b\\\\ \\n\\t\\u0001\\u001f\"");
+        assert(escape<shell_policy>("it's") == "'it'\\''s'");
+    }
+    // dex60
+
+    void
+    bench()
+    {
+        std::string text;
+        unsigned    seed = 1;
+        while (text.size() < (16 << 20))
+        {
+            seed = seed * 1103515245 + 12345;
+            text += (seed >> 8) % 97 == 0 ? '"' : char('a' + (seed >> 12) % 26);
+        }
+        std::string out(max_escaped_size<json_policy>(text.size()), '\0');
+        auto        time_one = [&](const char *name, auto f) {
+            auto [n, s] = bench::timed(f);
+            printf("ex60: %-30s %6.2f GB/s (%zu bytes)\n", name, text.size() / s / 1e9, n);
+        };
+        time_one("ex29 do_quote to char*", [&] {
+            return ex29::do_quote(text.begin(), text.end(), out.data()) - out.data();
+        });
+        time_one("ex29 quoted to ostringstream", [&] {
+            std::ostringstream oss;
+            oss << ex29::quoted(text);
+            return oss.str().size();
+        });
+        time_one("escape_to<backslash_policy>", [&] {
+            return escape_to<backslash_policy>(text, out.data()) - out.data();
+        });
+        time_one("escape_to<json_policy>", [&] { return escape_to<json_policy>(text, out.data()) - out.data(); });
+        time_one("escape_to<csv_policy>", [&] { return escape_to<csv_policy>(text, out.data()) - out.data(); });
+        time_one("escaped<> to ostringstream", [&] {
+            std::ostringstream oss;
+            oss << escaped<backslash_policy>{text};
+            return oss.str().size();
+        });
+    }
+} // namespace ex60
+
+namespace ex61
+{
+    // ex61
+    struct streambuf_options
+    {
+        size_t capacity  = 1 << 20;
+        FILE  *sync_with = nullptr; // if set, flushed before each of our writes;
+                                    // it must outlive the stream
+    };
+
+    // An output streambuf over a file descriptor whose put area is one
+    // large buffer, exposed for direct writes (reserve/commit) and bulk
+    // fill(), so formatting code needn't go through sputc per character.
+    class fast_streambuf : public std::streambuf
+    {
+        int                     m_fd;
+        std::unique_ptr<char[]> m_buffer;
+        size_t                  m_capacity;
+        FILE                   *m_sync_with;
+
+        bool
+        write_all(const char *p, size_t n)
+        {
+            if (n == 0)
+            {
+                return true;
+            }
+            if (m_sync_with)
+            {
+                fflush(m_sync_with);
+            }
+            while (n != 0)
+            {
+                ssize_t k = ::write(m_fd, p, n);
+                if (k < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                p += k;
+                n -= k;
+            }
+            return true;
+        }
+
+        bool
+        drain()
+        {
+            bool ok = write_all(pbase(), pptr() - pbase());
+            setp(m_buffer.get(), m_buffer.get() + m_capacity);
+            return ok;
+        }
+
+      protected:
+        int_type
+        overflow(int_type ch) override
+        {
+            if (!drain())
+            {
+                return traits_type::eof();
+            }
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        std::streamsize
+        xsputn(const char *s, std::streamsize n) override
+        {
+            if (size_t(epptr() - pptr()) >= size_t(n))
+            {
+                std::memcpy(pptr(), s, n);
+                pbump(n);
+                return n;
+            }
+            if (!drain())
+            {
+                return 0;
+            }
+            if (size_t(n) >= m_capacity)
+            {
+                return write_all(s, n) ? n : 0;
+            }
+            std::memcpy(pptr(), s, n);
+            pbump(n);
+            return n;
+        }
+
+        int
+        sync() override
+        {
+            return drain() ? 0 : -1;
+        }
+
+      public:
+        explicit fast_streambuf(int fd, streambuf_options opt = {})
+            : m_fd(fd), m_buffer(std::make_unique_for_overwrite<char[]>(std::max<size_t>(opt.capacity, 64))),
+              m_capacity(std::max<size_t>(opt.capacity, 64)), m_sync_with(opt.sync_with)
+        {
+            setp(m_buffer.get(), m_buffer.get() + m_capacity);
+        }
+
+        ~fast_streambuf()
+        {
+            drain();
+        }
+
+        // At least n contiguous bytes at pptr(), for n up to the capacity;
+        // write into them, then commit() what was used.
+        std::span<char>
+        reserve(size_t n)
+        {
+            if (size_t(epptr() - pptr()) < n)
+            {
+                drain();
+            }
+            return {pptr(), size_t(epptr() - pptr())};
+        }
+
+        void
+        commit(size_t n)
+        {
+            pbump(n);
+        }
+
+        void
+        fill(char ch, size_t n)
+        {
+            while (n != 0)
+            {
+                auto   room = reserve(1);
+                size_t k    = std::min(n, room.size());
+                std::memset(room.data(), ch, k);
+                commit(k);
+                n -= k;
+            }
+        }
+    };
+
+    // An ostream that owns a fast_streambuf. Given "sync_with", it also
+    // sets unitbuf, so each << statement reaches the file in order with
+    // that FILE's output; otherwise nothing is written until the buffer
+    // fills or the stream is flushed.
+    class fast_ostream : public std::ostream
+    {
+        fast_streambuf m_buf;
+
+      public:
+        explicit fast_ostream(int fd, streambuf_options opt = {}) : std::ostream(nullptr), m_buf(fd, opt)
+        {
+            rdbuf(&m_buf);
+            if (opt.sync_with)
+            {
+                setf(std::ios_base::unitbuf);
+            }
+        }
+    };
+
+    // ex20's pad, filling in bulk: straight into a fast_streambuf's put
+    // area, or else a block at a time instead of a character at a time.
+    void
+    pad(std::ostream &os, size_t from, size_t to)
+    {
+        if (from >= to)
+        {
+            return;
+        }
+        if (auto *fast = dynamic_cast<fast_streambuf *>(os.rdbuf()))
+        {
+            fast->fill(os.fill(), to - from);
+            return;
+        }
+        char block[64];
+        std::memset(block, os.fill(), sizeof block);
+        for (size_t n = to - from; n != 0;)
+        {
+            size_t k = std::min(n, sizeof block);
+            os.write(block, k);
+            n -= k;
+        }
+    }
+
+    std::ostream &
+    operator<<(std::ostream &os, const std::string &s)
+    {
+        auto column_width = os.width();
+        auto padding      = os.flags() & std::ios_base::adjustfield;
+
+        if (padding == std::ios_base::right)
+        {
+            pad(os, s.size(), column_width);
+        }
+        os.write(s.data(), s.size());
+        if (padding == std::ios_base::left)
+        {
+            pad(os, s.size(), column_width);
+        }
+        os.width(0);
+        return os;
+    }
+
+    template <class F>
+    void
+    write_sample(std::ostream &os, F put)
+    {
+        std::string where = "Chicago";
+        std::string big(300, 'z');
+        os << std::setw(8) << std::left;
+        put(os, where);
+        os << "." << std::setw(4) << std::right << std::hex << 225 << std::dec << "\n";
+        os << std::setw(100) << std::setfill('*');
+        put(os, where);
+        os << std::setfill(' ') << "|" << 3.5 << "|" << -42 << "|";
+        put(os, big);
+        os << '\n';
+    }
+
+    void
+    test()
+    {
+        auto with_ex20 = [](std::ostream &os, const std::string &s) { ex20::operator<<(os, s); };
+        auto with_ex61 = [](std::ostream &os, const std::string &s) { ex61::operator<<(os, s); };
+
+        std::ostringstream expected;
+        write_sample(expected, with_ex20);
+        const char *path = "myfile.txt";
+        for (size_t capacity : {64, 4096})
+        {
+            {
+                int          fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                fast_ostream os(fd, {.capacity = capacity});
+                write_sample(os, with_ex61);
+                os.flush();
+                close(fd);
+            }
+            assert(ex52::slurp(path) == expected.str());
+        }
+
+        // With sync_with, output interleaves correctly with the FILE's.
+        {
+            FILE *fp = fopen(path, "w");
+            {
+                fast_ostream os(fileno(fp), {.sync_with = fp});
+                fprintf(fp, "A");
+                os << "B" << 1;
+                fprintf(fp, "C");
+                os << "D";
+            }
+            fclose(fp);
+        }
+        assert(ex52::slurp(path) == "AB1CD");
+    }
+    // dex61
+
+    void
+    bench()
+    {
+        constexpr int rows = 200000;
+        std::string   cell = "Chicago";
+        auto          time_one = [&](const char *name, std::ostream &os, auto put) {
+            double s = bench::timed([&] {
+                for (int i = 0; i < rows; ++i)
+                {
+                    os << std::setw(40) << std::left;
+                    put(os, cell);
+                    os << std::setw(40) << std::right;
+                    put(os, cell);
+                    os << i << '\n';
+                }
+                os.flush();
+            }).seconds;
+            printf("ex61: %-34s %6.1f ns/row\n", name, s * 1e9 / rows);
+        };
+        auto with_ex20 = [](std::ostream &os, const std::string &s) { ex20::operator<<(os, s); };
+        auto with_ex61 = [](std::ostream &os, const std::string &s) { ex61::operator<<(os, s); };
+
+        std::ofstream ofs("/dev/null");
+        time_one("ex20 pad, ofstream", ofs, with_ex20);
+        time_one("bulk pad, ofstream", ofs, with_ex61);
+        int          fd = open("/dev/null", O_WRONLY);
+        fast_ostream fast(fd);
+        time_one("ex20 pad, fast_ostream", fast, with_ex20);
+        time_one("bulk pad, fast_ostream", fast, with_ex61);
+        fast.flush();
+        close(fd);
+    }
+} // namespace ex61
+
 int
 main()
 {
@@ -1082,4 +5368,30 @@ main()
     ex41::test();
     ex42::test();
     ex46::test();
+    ex49::test();
+    ex49::bench();
+    ex50::test();
+    ex50::bench();
+    ex51::test();
+    ex51::bench();
+    ex52::test();
+    ex52::bench();
+    ex53::test();
+    ex53::bench();
+    ex54::test();
+    ex54::bench();
+    ex55::test();
+    ex55::bench();
+    ex56::test();
+    ex56::bench();
+    ex57::test();
+    ex57::bench();
+    ex58::test();
+    ex58::bench();
+    ex59::test();
+    ex59::bench();
+    ex60::test();
+    ex60::bench();
+    ex61::test();
+    ex61::bench();
 }
@@ -1,17 +1,28 @@
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cctype>
+#include <charconv>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <iterator>
 #include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <regex>
 #include <string>
 #include <string_view>
+#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
+#include "../common/bench.h"
+#include "../common/line_reader.h"
+
 namespace ex1
 {
     /*
@@ -626,6 +637,2145 @@ namespace ex24
     // dex24
 } // namespace ex24
 
+namespace ex25
+{
+    // ex25
+    // ex14's robot, reading lines with fastio::line_reader instead of
+    // std::getline: no string copy per line, and no stoi either.
+    int
+    run(int fd)
+    {
+        std::regex          rx("(left|right) ([0-9]+)");
+        int                 pos = 0;
+        fastio::line_reader in(fd);
+        std::string_view    line;
+        while (getline(in, line))
+        {
+            std::cmatch m;
+            if (!std::regex_match(line.data(), line.data() + line.size(), m, rx))
+            {
+                printf("Failed to lex '%.*s'; robot is still at %d.\n", int(line.size()), line.data(), pos);
+                continue;
+            }
+            int how_far = 0;
+            std::from_chars(m[2].first, m[2].second, how_far);
+            int direction = (m[1] == "left") ? -1 : 1;
+            pos += how_far * direction;
+        }
+        return pos;
+    }
+
+    void
+    test()
+    {
+        int         fds[2];
+        std::string input = "left 3\nright 10\nup 2\nleft 1";
+        int         rc    = pipe(fds);
+        assert(rc == 0);
+        ssize_t n = write(fds[1], input.data(), input.size());
+        assert(n == ssize_t(input.size()));
+        (void)rc;
+        (void)n;
+        close(fds[1]);
+        int pos = run(fds[0]);
+        assert(pos == 6);
+        (void)pos;
+        close(fds[0]);
+    }
+    // dex25
+} // namespace ex25
+
+namespace ex26
+{
+    // ex26
+    // A regex engine for the ECMAScript subset the examples above use:
+    // literals, ".", [classes], \d \w \s and their negations, ^ $ \b \B,
+    // capturing and "(?:" groups, "|", and the * + ? {n,m} quantifiers,
+    // greedy or lazy. Backreferences and lookarounds are left out, which is
+    // what keeps every pass below linear in the input.
+    //
+    // A pattern compiles to a small Pike-VM program. match() and search()
+    // first run a DFA built lazily from that program, one table lookup per
+    // byte. Only when captures are asked for, and the DFA has said yes, does
+    // a second pass find where the groups are: a bounded backtracker for
+    // short inputs, the Pike VM for long ones. None of them recurse, so a
+    // long line costs time, not stack.
+    enum class regex_flags : unsigned
+    {
+        none  = 0,
+        icase = 1,
+    };
+
+    constexpr bool
+    is_word(unsigned char c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    class charset
+    {
+        uint64_t m_bits[4] = {};
+
+      public:
+        constexpr void
+        set(unsigned char c)
+        {
+            m_bits[c >> 6] |= uint64_t(1) << (c & 63);
+        }
+        constexpr void
+        set(unsigned char lo, unsigned char hi)
+        {
+            for (int c = lo; c <= hi; ++c)
+            {
+                set(c);
+            }
+        }
+        constexpr bool
+        test(unsigned char c) const
+        {
+            return (m_bits[c >> 6] >> (c & 63)) & 1;
+        }
+        constexpr void
+        invert()
+        {
+            for (auto &w : m_bits)
+            {
+                w = ~w;
+            }
+        }
+        constexpr charset &
+        operator|=(const charset &rhs)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                m_bits[i] |= rhs.m_bits[i];
+            }
+            return *this;
+        }
+        // Add the other case of every ASCII letter in the set.
+        constexpr void
+        fold_case()
+        {
+            for (int c = 'a'; c <= 'z'; ++c)
+            {
+                if (test(c) || test(c - 32))
+                {
+                    set(c);
+                    set(c - 32);
+                }
+            }
+        }
+    };
+
+    // \d \w \s, or with an upper-case letter, their complements.
+    constexpr charset
+    class_escape(char c)
+    {
+        charset cs;
+        switch (c | 0x20)
+        {
+        case 'd':
+            cs.set('0', '9');
+            break;
+        case 'w':
+            cs.set('0', '9');
+            cs.set('a', 'z');
+            cs.set('A', 'Z');
+            cs.set('_');
+            break;
+        case 's':
+            cs.set(' ');
+            cs.set('\t', '\r');
+            break;
+        }
+        if (c >= 'A' && c <= 'Z')
+        {
+            cs.invert();
+        }
+        return cs;
+    }
+
+    enum class opcode : uint8_t
+    {
+        match,    // accept
+        cls,      // consume one byte that is in classes[x]
+        split,    // continue at x, or failing that at y
+        jmp,      // continue at x
+        save,     // record the position in capture slot x
+        bol,      // ^
+        eol,      // $
+        word,     // \b
+        not_word, // \B
+    };
+
+    struct inst
+    {
+        opcode op;
+        int    x = 0;
+        int    y = 0;
+    };
+
+    struct program
+    {
+        std::vector<inst>    code;
+        std::vector<charset> classes;
+        int                  groups = 0; // capturing groups, not counting the whole match
+    };
+
+    constexpr bool
+    assertion_holds(opcode op, bool at_begin, bool at_end, bool prev_word, bool next_word)
+    {
+        switch (op)
+        {
+        case opcode::bol:
+            return at_begin;
+        case opcode::eol:
+            return at_end;
+        case opcode::word:
+            return prev_word != next_word;
+        default:
+            return prev_word == next_word;
+        }
+    }
+
+    // Everything here is constexpr, so the same parser can run inside a
+    // consteval function when the pattern is a literal.
+    class regex_parser
+    {
+        enum class kind : uint8_t
+        {
+            empty,
+            cls,
+            cat,
+            alt,
+            group,
+            repeat,
+            assertion,
+        };
+        struct node
+        {
+            kind k;
+            int  a      = -1; // first child, or the class, or the assertion's opcode
+            int  b      = -1; // second child, or the group number
+            int  min    = 0;
+            int  max    = 0; // -1 for no upper bound
+            bool greedy = true;
+        };
+        static constexpr int    max_repeat = 1000;
+        static constexpr size_t max_code   = 1 << 16;
+
+        std::string_view  m_pattern;
+        size_t            m_pos = 0;
+        bool              m_icase;
+        std::vector<node> m_nodes;
+        program           m_prog;
+
+        constexpr bool
+        at_end() const
+        {
+            return m_pos == m_pattern.size();
+        }
+        constexpr char
+        peek() const
+        {
+            return m_pattern[m_pos];
+        }
+        constexpr bool
+        eat(char c)
+        {
+            if (!at_end() && peek() == c)
+            {
+                ++m_pos;
+                return true;
+            }
+            return false;
+        }
+        static constexpr bool
+        is_quantifier(char c)
+        {
+            return c == '*' || c == '+' || c == '?' || c == '{';
+        }
+
+        constexpr int
+        add(node nd)
+        {
+            m_nodes.push_back(nd);
+            return int(m_nodes.size()) - 1;
+        }
+        constexpr int
+        add_class(const charset &cs)
+        {
+            m_prog.classes.push_back(cs);
+            return add({kind::cls, int(m_prog.classes.size()) - 1});
+        }
+        constexpr int
+        literal(unsigned char c)
+        {
+            charset cs;
+            cs.set(c);
+            if (m_icase)
+            {
+                cs.fold_case();
+            }
+            return add_class(cs);
+        }
+
+        constexpr int
+        parse_alt()
+        {
+            int left = parse_cat();
+            while (eat('|'))
+            {
+                int right = parse_cat();
+                left      = add({kind::alt, left, right});
+            }
+            return left;
+        }
+
+        constexpr int
+        parse_cat()
+        {
+            int left = -1;
+            while (!at_end() && peek() != '|' && peek() != ')')
+            {
+                int right = parse_repeat();
+                left      = (left < 0) ? right : add({kind::cat, left, right});
+            }
+            return (left < 0) ? add({kind::empty}) : left;
+        }
+
+        constexpr int
+        parse_repeat()
+        {
+            int atom = parse_atom();
+            if (at_end() || !is_quantifier(peek()))
+            {
+                return atom;
+            }
+            if (m_nodes[atom].k == kind::assertion)
+            {
+                throw std::regex_error(std::regex_constants::error_badrepeat);
+            }
+            int min = 0, max = -1;
+            switch (m_pattern[m_pos++])
+            {
+            case '*':
+                break;
+            case '+':
+                min = 1;
+                break;
+            case '?':
+                max = 1;
+                break;
+            default: // '{'
+                min = max = parse_int();
+                if (eat(','))
+                {
+                    max = (!at_end() && peek() == '}') ? -1 : parse_int();
+                }
+                if (!eat('}'))
+                {
+                    throw std::regex_error(std::regex_constants::error_brace);
+                }
+                if (max >= 0 && max < min)
+                {
+                    throw std::regex_error(std::regex_constants::error_badbrace);
+                }
+            }
+            bool greedy = !eat('?');
+            if (!at_end() && is_quantifier(peek()))
+            {
+                throw std::regex_error(std::regex_constants::error_badrepeat);
+            }
+            return add({kind::repeat, atom, -1, min, max, greedy});
+        }
+
+        constexpr int
+        parse_int()
+        {
+            size_t start = m_pos;
+            int    n     = 0;
+            while (!at_end() && peek() >= '0' && peek() <= '9')
+            {
+                n = n * 10 + (m_pattern[m_pos++] - '0');
+                if (n > max_repeat)
+                {
+                    throw std::regex_error(std::regex_constants::error_complexity);
+                }
+            }
+            if (m_pos == start)
+            {
+                throw std::regex_error(std::regex_constants::error_badbrace);
+            }
+            return n;
+        }
+
+        constexpr int
+        parse_atom()
+        {
+            char c = m_pattern[m_pos++];
+            switch (c)
+            {
+            case '(':
+            {
+                int group = -1;
+                if (eat('?'))
+                {
+                    if (!eat(':'))
+                    {
+                        throw std::regex_error(std::regex_constants::error_paren); // no lookarounds
+                    }
+                }
+                else
+                {
+                    group = ++m_prog.groups;
+                }
+                int inner = parse_alt();
+                if (!eat(')'))
+                {
+                    throw std::regex_error(std::regex_constants::error_paren);
+                }
+                return (group < 0) ? inner : add({kind::group, inner, group});
+            }
+            case '[':
+                return parse_class();
+            case '.':
+            {
+                charset cs;
+                cs.set('\n');
+                cs.set('\r');
+                cs.invert();
+                return add_class(cs);
+            }
+            case '^':
+                return add({kind::assertion, int(opcode::bol)});
+            case '$':
+                return add({kind::assertion, int(opcode::eol)});
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+                throw std::regex_error(std::regex_constants::error_badrepeat);
+            case '\\':
+                return parse_escape();
+            default:
+                return literal(c);
+            }
+        }
+
+        constexpr int
+        parse_escape()
+        {
+            if (at_end())
+            {
+                throw std::regex_error(std::regex_constants::error_escape);
+            }
+            char c = m_pattern[m_pos++];
+            switch (c)
+            {
+            case 'b':
+                return add({kind::assertion, int(opcode::word)});
+            case 'B':
+                return add({kind::assertion, int(opcode::not_word)});
+            case 'd':
+            case 'D':
+            case 'w':
+            case 'W':
+            case 's':
+            case 'S':
+                return add_class(class_escape(c));
+            default:
+                return literal(escape_char(c));
+            }
+        }
+
+        constexpr int
+        hex_digit()
+        {
+            char c = at_end() ? 0 : m_pattern[m_pos++];
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0';
+            }
+            if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            {
+                return (c | 0x20) - 'a' + 10;
+            }
+            throw std::regex_error(std::regex_constants::error_escape);
+        }
+
+        // The escapes that stand for a single byte, inside or outside [...].
+        constexpr unsigned char
+        escape_char(char c)
+        {
+            switch (c)
+            {
+            case 'n':
+                return '\n';
+            case 't':
+                return '\t';
+            case 'r':
+                return '\r';
+            case 'f':
+                return '\f';
+            case 'v':
+                return '\v';
+            case '0':
+                return '\0';
+            case 'x':
+            {
+                int hi = hex_digit();
+                return hi * 16 + hex_digit();
+            }
+            }
+            if (c >= '1' && c <= '9')
+            {
+                throw std::regex_error(std::regex_constants::error_backref);
+            }
+            if (is_word(c))
+            {
+                throw std::regex_error(std::regex_constants::error_escape);
+            }
+            return c;
+        }
+
+        constexpr int
+        parse_class()
+        {
+            charset cs;
+            bool    negate = eat('^');
+            while (!eat(']'))
+            {
+                if (at_end())
+                {
+                    throw std::regex_error(std::regex_constants::error_brack);
+                }
+                charset item;
+                int     lo = class_atom(item);
+                if (lo >= 0 && m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos + 1] != ']')
+                {
+                    ++m_pos;
+                    int hi = class_atom(item);
+                    if (hi < lo)
+                    {
+                        throw std::regex_error(std::regex_constants::error_range);
+                    }
+                    cs.set(lo, hi);
+                }
+                else if (lo >= 0)
+                {
+                    cs.set(lo);
+                }
+                else
+                {
+                    cs |= item;
+                }
+            }
+            if (m_icase)
+            {
+                cs.fold_case();
+            }
+            if (negate)
+            {
+                cs.invert();
+            }
+            return add_class(cs);
+        }
+
+        // One member of a [...] class: its byte, or -1 after adding a \d-style
+        // escape to cs.
+        constexpr int
+        class_atom(charset &cs)
+        {
+            char c = m_pattern[m_pos++];
+            if (c != '\\')
+            {
+                return (unsigned char)c;
+            }
+            if (at_end())
+            {
+                throw std::regex_error(std::regex_constants::error_escape);
+            }
+            c = m_pattern[m_pos++];
+            switch (c)
+            {
+            case 'd':
+            case 'D':
+            case 'w':
+            case 'W':
+            case 's':
+            case 'S':
+                cs |= class_escape(c);
+                return -1;
+            case 'b':
+                return '\b';
+            default:
+                return escape_char(c);
+            }
+        }
+
+        constexpr int
+        emit(inst i)
+        {
+            if (m_prog.code.size() == max_code)
+            {
+                throw std::regex_error(std::regex_constants::error_complexity);
+            }
+            m_prog.code.push_back(i);
+            return int(m_prog.code.size()) - 1;
+        }
+        constexpr int
+        here() const
+        {
+            return int(m_prog.code.size());
+        }
+        constexpr void
+        branch(int at, int body, int skip, bool greedy)
+        {
+            m_prog.code[at].x = greedy ? body : skip;
+            m_prog.code[at].y = greedy ? skip : body;
+        }
+
+        constexpr void
+        gen(int n)
+        {
+            const node nd = m_nodes[n];
+            switch (nd.k)
+            {
+            case kind::empty:
+                break;
+            case kind::cls:
+                emit({opcode::cls, nd.a});
+                break;
+            case kind::assertion:
+                emit({opcode(nd.a)});
+                break;
+            case kind::cat:
+            {
+                // Walk the left spine: "abc...z" is a chain as long as the pattern.
+                std::vector<int> rights;
+                while (m_nodes[n].k == kind::cat)
+                {
+                    rights.push_back(m_nodes[n].b);
+                    n = m_nodes[n].a;
+                }
+                gen(n);
+                for (auto it = rights.rbegin(); it != rights.rend(); ++it)
+                {
+                    gen(*it);
+                }
+                break;
+            }
+            case kind::alt:
+            {
+                int split = emit({opcode::split, here() + 1});
+                gen(nd.a);
+                int jmp              = emit({opcode::jmp});
+                m_prog.code[split].y = here();
+                gen(nd.b);
+                m_prog.code[jmp].x = here();
+                break;
+            }
+            case kind::group:
+                emit({opcode::save, 2 * nd.b});
+                gen(nd.a);
+                emit({opcode::save, 2 * nd.b + 1});
+                break;
+            case kind::repeat:
+                for (int i = 0; i < nd.min; ++i)
+                {
+                    gen(nd.a);
+                }
+                if (nd.max < 0)
+                {
+                    int split = emit({opcode::split});
+                    gen(nd.a);
+                    emit({opcode::jmp, split});
+                    branch(split, split + 1, here(), nd.greedy);
+                }
+                else
+                {
+                    std::vector<int> splits;
+                    for (int i = nd.min; i < nd.max; ++i)
+                    {
+                        splits.push_back(emit({opcode::split}));
+                        gen(nd.a);
+                    }
+                    for (int split : splits)
+                    {
+                        branch(split, split + 1, here(), nd.greedy);
+                    }
+                }
+                break;
+            }
+        }
+
+      public:
+        constexpr regex_parser(std::string_view pattern, regex_flags flags)
+            : m_pattern(pattern), m_icase(unsigned(flags) & unsigned(regex_flags::icase))
+        {
+        }
+
+        constexpr program
+        compile() &&
+        {
+            int root = parse_alt();
+            if (!at_end())
+            {
+                throw std::regex_error(std::regex_constants::error_paren);
+            }
+            emit({opcode::save, 0});
+            gen(root);
+            emit({opcode::save, 1});
+            emit({opcode::match});
+            return std::move(m_prog);
+        }
+    };
+
+    constexpr program
+    compile(std::string_view pattern, regex_flags flags = regex_flags::none)
+    {
+        return regex_parser(pattern, flags).compile();
+    }
+
+    // Every fast_regex built from the same pattern and flags shares one
+    // program; only the first one pays for parsing.
+    std::shared_ptr<const program>
+    compile_cached(std::string_view pattern, regex_flags flags)
+    {
+        static std::mutex                                                      mtx;
+        static std::unordered_map<std::string, std::shared_ptr<const program>> cache;
+
+        std::string key(1, char('0' + unsigned(flags)));
+        key += pattern;
+        std::lock_guard lock(mtx);
+        if (auto it = cache.find(key); it != cache.end())
+        {
+            return it->second;
+        }
+        auto prog = std::make_shared<const program>(compile(pattern, flags));
+        cache.emplace(std::move(key), prog);
+        return prog;
+    }
+
+    class fast_match
+    {
+        std::vector<std::string_view> m_groups;
+        friend class backtracker;
+        friend class pike_vm;
+
+        // From capture slots: group g is [caps[2g], caps[2g + 1]).
+        void
+        assign(const char *const *caps, size_t groups)
+        {
+            m_groups.resize(groups);
+            for (size_t g = 0; g < groups; ++g)
+            {
+                const char *b = caps[2 * g], *e = caps[2 * g + 1];
+                m_groups[g]   = (b && e) ? std::string_view(b, e - b) : std::string_view();
+            }
+        }
+
+      public:
+        size_t
+        size() const
+        {
+            return m_groups.size();
+        }
+        bool
+        matched(size_t i) const
+        {
+            return m_groups[i].data() != nullptr;
+        }
+        std::string_view
+        operator[](size_t i) const
+        {
+            return m_groups[i];
+        }
+        std::string
+        str(size_t i = 0) const
+        {
+            return std::string(m_groups[i]);
+        }
+    };
+
+    // A DFA state is the set of program counters still alive after some
+    // prefix of the input (before following their epsilon edges), plus what
+    // the assertions need to know about that prefix: whether it is empty and
+    // whether it ended in a word character. States are made the first time a
+    // transition is taken and remembered in a 257-column table, the last
+    // column answering "is this a match at end of input?".
+    class lazy_dfa
+    {
+        static constexpr int    max_states = 1024;
+        static constexpr size_t stride     = 257;
+        static constexpr int    dead       = 0;
+
+        const program                  *m_prog;
+        bool                            m_unanchored;
+        bool                            m_uses_bol  = false;
+        bool                            m_uses_word = false;
+        std::map<std::vector<int>, int> m_ids;
+        std::vector<std::vector<int>>   m_keys;  // sorted pcs, then the flags
+        std::vector<int32_t>            m_table; // (next << 1) | matched_before, or -1
+        int                             m_start[4];
+        unsigned                        m_resets = 0;
+        std::vector<unsigned>           m_mark;
+        unsigned                        m_gen = 0;
+        std::vector<int>                m_stack;
+        std::vector<int>                m_next;
+
+        // Out of room: drop every state and start again from the current one.
+        void
+        reset()
+        {
+            m_ids.clear();
+            m_keys.clear();
+            m_table.clear();
+            std::fill(std::begin(m_start), std::end(m_start), -1);
+            ++m_resets;
+            intern({0}); // no threads left: the dead state
+        }
+
+        int
+        intern(const std::vector<int> &key)
+        {
+            if (auto it = m_ids.find(key); it != m_ids.end())
+            {
+                return it->second;
+            }
+            if (m_keys.size() == max_states)
+            {
+                reset();
+            }
+            int id = int(m_keys.size());
+            m_keys.push_back(key);
+            m_ids.emplace(key, id);
+            m_table.resize(m_table.size() + stride, -1);
+            return id;
+        }
+
+        int
+        start(bool at_begin, bool prev_word)
+        {
+            int flags = (at_begin && m_uses_bol) * 2 + (prev_word && m_uses_word);
+            if (m_start[flags] < 0)
+            {
+                m_start[flags] = intern({0, flags});
+            }
+            return m_start[flags];
+        }
+
+        int32_t
+        step(int state, int c)
+        {
+            std::vector<int> kernel = m_keys[state]; // intern() below may reset
+            int              flags  = kernel.back();
+            kernel.pop_back();
+            bool at_end    = (c == 256);
+            bool next_word = !at_end && is_word(c);
+            bool matched   = false;
+            if (++m_gen == 0)
+            {
+                std::fill(m_mark.begin(), m_mark.end(), 0);
+                m_gen = 1;
+            }
+            m_stack.assign(kernel.begin(), kernel.end());
+            m_next.clear();
+            while (!m_stack.empty())
+            {
+                int pc = m_stack.back();
+                m_stack.pop_back();
+                if (m_mark[pc] == m_gen)
+                {
+                    continue;
+                }
+                m_mark[pc]     = m_gen;
+                const inst &in = m_prog->code[pc];
+                switch (in.op)
+                {
+                case opcode::match:
+                    matched = true;
+                    break;
+                case opcode::cls:
+                    if (!at_end && m_prog->classes[in.x].test(c))
+                    {
+                        m_next.push_back(pc + 1);
+                    }
+                    break;
+                case opcode::jmp:
+                    m_stack.push_back(in.x);
+                    break;
+                case opcode::split:
+                    m_stack.push_back(in.y);
+                    m_stack.push_back(in.x);
+                    break;
+                case opcode::save:
+                    m_stack.push_back(pc + 1);
+                    break;
+                default:
+                    if (assertion_holds(in.op, flags & 2, at_end, flags & 1, next_word))
+                    {
+                        m_stack.push_back(pc + 1);
+                    }
+                    break;
+                }
+            }
+            if (at_end)
+            {
+                m_table[state * stride + 256] = matched;
+                return matched;
+            }
+            if (m_unanchored)
+            {
+                m_next.push_back(0); // a match may also start at the next byte
+            }
+            std::sort(m_next.begin(), m_next.end());
+            m_next.erase(std::unique(m_next.begin(), m_next.end()), m_next.end());
+            m_next.push_back((m_next.empty() || !m_uses_word) ? 0 : next_word);
+
+            unsigned resets = m_resets;
+            int32_t  t      = intern(m_next) * 2 + matched;
+            if (resets == m_resets)
+            {
+                m_table[state * stride + c] = t;
+            }
+            return t;
+        }
+
+      public:
+        lazy_dfa(const program &prog, bool unanchored)
+            : m_prog(&prog), m_unanchored(unanchored), m_mark(prog.code.size(), 0)
+        {
+            for (const inst &in : prog.code)
+            {
+                m_uses_bol |= (in.op == opcode::bol);
+                m_uses_word |= (in.op == opcode::word || in.op == opcode::not_word);
+            }
+            reset();
+        }
+
+        // Unanchored: does s[from..] contain a match? Anchored: is s[from..]
+        // a match?
+        bool
+        run(std::string_view s, size_t from)
+        {
+            auto   *p     = reinterpret_cast<const unsigned char *>(s.data()) + from;
+            auto   *end   = reinterpret_cast<const unsigned char *>(s.data()) + s.size();
+            int     state = start(from == 0, from > 0 && is_word(s[from - 1]));
+            int32_t t;
+            for (; p != end; ++p)
+            {
+                t = m_table[state * stride + *p];
+                if (t < 0)
+                {
+                    t = step(state, *p);
+                }
+                if (m_unanchored && (t & 1))
+                {
+                    return true;
+                }
+                state = t >> 1;
+                if (state == dead)
+                {
+                    return false;
+                }
+            }
+            t = m_table[state * stride + 256];
+            if (t < 0)
+            {
+                t = step(state, 256);
+            }
+            return t & 1;
+        }
+    };
+
+    // Depth first in priority order, like std::regex, but never trying the
+    // same instruction at the same position twice, so the work is bounded by
+    // code size times input length. The visited bitmap is that big too, which
+    // is why only short inputs come here; it beats the Pike VM on them by not
+    // carrying every thread's captures along.
+    class backtracker
+    {
+        static constexpr size_t max_bits = 256 * 1024;
+
+        struct job
+        {
+            int         pc;
+            int         slot; // >= 0: restore m_caps[slot] to sp
+            const char *sp;
+        };
+
+        const program            *m_prog;
+        std::vector<uint64_t>     m_visited;
+        std::vector<job>          m_jobs;
+        std::vector<const char *> m_caps;
+        const char               *m_begin = nullptr;
+        const char               *m_end   = nullptr;
+        size_t                    m_width = 0;
+
+        bool
+        visit(int pc, const char *sp)
+        {
+            size_t   bit  = pc * m_width + (sp - m_begin);
+            uint64_t mask = uint64_t(1) << (bit & 63);
+            if (m_visited[bit >> 6] & mask)
+            {
+                return false;
+            }
+            m_visited[bit >> 6] |= mask;
+            return true;
+        }
+
+        bool
+        try_from(const char *start, bool anchored)
+        {
+            m_jobs.push_back({0, -1, start});
+            while (!m_jobs.empty())
+            {
+                job j = m_jobs.back();
+                m_jobs.pop_back();
+                if (j.slot >= 0)
+                {
+                    m_caps[j.slot] = j.sp;
+                    continue;
+                }
+                // Follow one thread until it fails, leaving its alternatives
+                // on the stack.
+                int         pc = j.pc;
+                const char *sp = j.sp;
+                while (visit(pc, sp))
+                {
+                    const inst &in = m_prog->code[pc];
+                    if (in.op == opcode::match)
+                    {
+                        if (anchored && sp != m_end)
+                        {
+                            break;
+                        }
+                        m_jobs.clear();
+                        return true;
+                    }
+                    else if (in.op == opcode::cls)
+                    {
+                        if (sp == m_end || !m_prog->classes[in.x].test(*sp))
+                        {
+                            break;
+                        }
+                        ++sp;
+                        ++pc;
+                    }
+                    else if (in.op == opcode::jmp)
+                    {
+                        pc = in.x;
+                    }
+                    else if (in.op == opcode::split)
+                    {
+                        m_jobs.push_back({in.y, -1, sp});
+                        pc = in.x;
+                    }
+                    else if (in.op == opcode::save)
+                    {
+                        m_jobs.push_back({0, in.x, m_caps[in.x]});
+                        m_caps[in.x] = sp;
+                        ++pc;
+                    }
+                    else
+                    {
+                        bool prev_word = sp != m_begin && is_word(sp[-1]);
+                        bool next_word = sp != m_end && is_word(*sp);
+                        if (!assertion_holds(in.op, sp == m_begin, sp == m_end, prev_word, next_word))
+                        {
+                            break;
+                        }
+                        ++pc;
+                    }
+                }
+            }
+            return false;
+        }
+
+      public:
+        explicit backtracker(const program &prog) : m_prog(&prog), m_caps(2 * (prog.groups + 1))
+        {
+        }
+
+        bool
+        fits(size_t length) const
+        {
+            return m_prog->code.size() * (length + 1) <= max_bits;
+        }
+
+        bool
+        run(std::string_view s, size_t from, bool anchored, fast_match &m)
+        {
+            m_begin = s.data();
+            m_end   = m_begin + s.size();
+            m_width = s.size() + 1;
+            m_visited.assign((m_prog->code.size() * m_width + 63) / 64, 0);
+            std::fill(m_caps.begin(), m_caps.end(), nullptr);
+            // Failing from (pc, sp) doesn't depend on where the attempt
+            // started, so the visited bits carry over between starts.
+            for (const char *start = m_begin + from;; ++start)
+            {
+                if (try_from(start, anchored))
+                {
+                    m.assign(m_caps.data(), m_prog->groups + 1);
+                    return true;
+                }
+                if (anchored || start == m_end)
+                {
+                    return false;
+                }
+            }
+        }
+    };
+
+    // Runs every thread of the program in lockstep over the input, highest
+    // priority first, so the captures it reports are the ones a backtracking
+    // ECMAScript matcher would have found.
+    class pike_vm
+    {
+        struct frame
+        {
+            int         pc;
+            int         slot; // >= 0: restore m_work[slot] to old
+            const char *old;
+        };
+        struct thread_list
+        {
+            std::vector<int>          pcs;
+            std::vector<const char *> caps; // m_ncap per thread
+            void
+            clear()
+            {
+                pcs.clear();
+                caps.clear();
+            }
+        };
+
+        const program            *m_prog;
+        size_t                    m_ncap;
+        thread_list               m_clist, m_nlist;
+        std::vector<unsigned>     m_mark;
+        unsigned                  m_gen = 0;
+        std::vector<frame>        m_stack;
+        std::vector<const char *> m_work, m_best;
+        const char               *m_begin = nullptr;
+        const char               *m_end   = nullptr;
+
+        void
+        next_generation()
+        {
+            if (++m_gen == 0)
+            {
+                std::fill(m_mark.begin(), m_mark.end(), 0);
+                m_gen = 1;
+            }
+        }
+
+        // Follow the epsilon edges from pc, adding a thread with a copy of
+        // m_work at each cls or match instruction reached.
+        void
+        add(thread_list &l, int pc0, const char *sp)
+        {
+            m_stack.push_back({pc0, -1, nullptr});
+            while (!m_stack.empty())
+            {
+                frame f = m_stack.back();
+                m_stack.pop_back();
+                if (f.slot >= 0)
+                {
+                    m_work[f.slot] = f.old;
+                    continue;
+                }
+                if (m_mark[f.pc] == m_gen)
+                {
+                    continue;
+                }
+                m_mark[f.pc]   = m_gen;
+                const inst &in = m_prog->code[f.pc];
+                switch (in.op)
+                {
+                case opcode::jmp:
+                    m_stack.push_back({in.x, -1, nullptr});
+                    break;
+                case opcode::split:
+                    m_stack.push_back({in.y, -1, nullptr});
+                    m_stack.push_back({in.x, -1, nullptr});
+                    break;
+                case opcode::save:
+                    m_stack.push_back({0, in.x, m_work[in.x]});
+                    m_work[in.x] = sp;
+                    m_stack.push_back({f.pc + 1, -1, nullptr});
+                    break;
+                case opcode::cls:
+                case opcode::match:
+                    l.pcs.push_back(f.pc);
+                    l.caps.insert(l.caps.end(), m_work.begin(), m_work.end());
+                    break;
+                default:
+                {
+                    bool prev_word = sp != m_begin && is_word(sp[-1]);
+                    bool next_word = sp != m_end && is_word(*sp);
+                    if (assertion_holds(in.op, sp == m_begin, sp == m_end, prev_word, next_word))
+                    {
+                        m_stack.push_back({f.pc + 1, -1, nullptr});
+                    }
+                    break;
+                }
+                }
+            }
+        }
+
+      public:
+        explicit pike_vm(const program &prog)
+            : m_prog(&prog), m_ncap(2 * (prog.groups + 1)), m_mark(prog.code.size(), 0), m_work(m_ncap),
+              m_best(m_ncap)
+        {
+        }
+
+        bool
+        run(std::string_view s, size_t from, bool anchored, fast_match &m)
+        {
+            m_begin      = s.data();
+            m_end        = m_begin + s.size();
+            bool matched = false;
+            m_clist.clear();
+            std::fill(m_work.begin(), m_work.end(), nullptr);
+            next_generation();
+            add(m_clist, 0, m_begin + from);
+            for (const char *sp = m_begin + from;; ++sp)
+            {
+                next_generation();
+                m_nlist.clear();
+                for (size_t i = 0; i < m_clist.pcs.size(); ++i)
+                {
+                    int          pc   = m_clist.pcs[i];
+                    const char **caps = &m_clist.caps[i * m_ncap];
+                    const inst  &in   = m_prog->code[pc];
+                    if (in.op == opcode::match)
+                    {
+                        if (anchored && sp != m_end)
+                        {
+                            continue;
+                        }
+                        std::copy(caps, caps + m_ncap, m_best.begin());
+                        matched = true;
+                        break; // lower-priority threads can't win now
+                    }
+                    if (sp != m_end && m_prog->classes[in.x].test(*sp))
+                    {
+                        std::copy(caps, caps + m_ncap, m_work.begin());
+                        add(m_nlist, pc + 1, sp + 1);
+                    }
+                }
+                if (sp == m_end)
+                {
+                    break;
+                }
+                if (!anchored && !matched)
+                {
+                    std::fill(m_work.begin(), m_work.end(), nullptr);
+                    add(m_nlist, 0, sp + 1);
+                }
+                if (m_nlist.pcs.empty() && (anchored || matched))
+                {
+                    break;
+                }
+                std::swap(m_clist, m_nlist);
+            }
+            if (matched)
+            {
+                m.assign(m_best.data(), m_prog->groups + 1);
+            }
+            return matched;
+        }
+    };
+
+    // Like a std::regex plus the state it needs to match quickly: the DFA
+    // grows as it sees new input, so use one fast_regex per thread. The
+    // compiled program itself is shared through compile_cached().
+    class fast_regex
+    {
+        std::shared_ptr<const program> m_prog;
+        mutable lazy_dfa               m_whole;
+        mutable lazy_dfa               m_anywhere;
+        mutable backtracker            m_short;
+        mutable pike_vm                m_long;
+
+        // A null data() would make an empty match look unmatched.
+        static std::string_view
+        nonnull(std::string_view s)
+        {
+            return s.data() ? s : std::string_view("");
+        }
+
+        // Second pass, once the DFA has said there is a match.
+        bool
+        captures(std::string_view s, size_t from, bool anchored, fast_match &m) const
+        {
+            return m_short.fits(s.size()) ? m_short.run(s, from, anchored, m) : m_long.run(s, from, anchored, m);
+        }
+
+      public:
+        explicit fast_regex(std::string_view pattern, regex_flags flags = regex_flags::none)
+            : m_prog(compile_cached(pattern, flags)), m_whole(*m_prog, false), m_anywhere(*m_prog, true),
+              m_short(*m_prog), m_long(*m_prog)
+        {
+        }
+
+        size_t
+        mark_count() const
+        {
+            return m_prog->groups;
+        }
+
+        bool
+        match(std::string_view s) const
+        {
+            return m_whole.run(nonnull(s), 0);
+        }
+        bool
+        match(std::string_view s, fast_match &m) const
+        {
+            s = nonnull(s);
+            return m_whole.run(s, 0) && captures(s, 0, true, m);
+        }
+
+        // Searching from a nonzero offset is like match_prev_avail: ^ won't
+        // match there, but \b looks at s[from - 1].
+        bool
+        search(std::string_view s, size_t from = 0) const
+        {
+            return m_anywhere.run(nonnull(s), from);
+        }
+        bool
+        search(std::string_view s, fast_match &m, size_t from = 0) const
+        {
+            s = nonnull(s);
+            return m_anywhere.run(s, from) && captures(s, from, false, m);
+        }
+    };
+
+    std::pair<std::string, std::string>
+    parse_command(const char *p, const char *end)
+    {
+        // thread_local, not just static: matching grows the regex's DFA.
+        static thread_local const fast_regex rx("(left|right) ([0-9]+)");
+        fast_match                           m;
+        if (rx.match(std::string_view(p, end - p), m))
+        {
+            return {m.str(1), m.str(2)};
+        }
+        else
+        {
+            throw "Unrecognized command!";
+        }
+    }
+    // dex26
+
+    // Same answer as std::regex, group by group and position by position.
+    void
+    agree(const char *pattern, std::string_view input, regex_flags flags = regex_flags::none)
+    {
+        auto        syntax = (flags == regex_flags::icase) ? std::regex::ECMAScript | std::regex::icase
+                                                           : std::regex::ECMAScript;
+        std::regex  rx(pattern, syntax);
+        fast_regex  fx(pattern, flags);
+        program     prog = compile(pattern, flags);
+        pike_vm     vm(prog); // fast_regex only uses it on long inputs
+        const char *b = input.data();
+        const char *e = b + input.size();
+        for (bool whole : {true, false})
+        {
+            std::cmatch sm;
+            fast_match  fm, pm;
+            bool        expected = whole ? std::regex_match(b, e, sm, rx) : std::regex_search(b, e, sm, rx);
+            assert((whole ? fx.match(input) : fx.search(input)) == expected);
+            assert((whole ? fx.match(input, fm) : fx.search(input, fm)) == expected);
+            assert(vm.run(input, 0, whole, pm) == expected);
+            if (expected)
+            {
+                assert(fx.mark_count() == sm.size() - 1);
+                for (const fast_match *m : {&fm, &pm})
+                {
+                    assert(m->size() == sm.size());
+                    for (size_t i = 0; i < m->size(); ++i)
+                    {
+                        assert(m->matched(i) == sm[i].matched);
+                        assert(!m->matched(i) || ((*m)[i].data() == sm[i].first && (*m)[i].end() == sm[i].second));
+                    }
+                }
+            }
+        }
+    }
+
+    void
+    test()
+    {
+        char buf[]       = "left 20";
+        auto [dir, dist] = parse_command(buf, buf + 7);
+        assert(dir == "left" && dist == "20");
+
+        for (const char *line : {"left 20", "right 4", "up 3", "left 20x", "left ", "Left 2", ""})
+        {
+            agree("(left|right) ([0-9]+)", line);
+        }
+        agree("((left)|right) (-?[0-9]+)", "LEFT -3", regex_flags::icase);
+        agree("((left)|right) (-?[0-9]+)", "Right 7", regex_flags::icase);
+        agree("[^a-c]+", "ABCdef", regex_flags::icase);
+        for (const char *s : {"baby", "a bb", "ab", "b", "abc bb"})
+        {
+            agree("\\bb.", s);
+        }
+        agree("([0-9]+)|([a-z]+)", "abc123...456...");
+        agree("([0-9]+)|([a-z]+)", "...456");
+        agree("\\bstd::(\\w+)", "std::sort(std::begin(v), std::end(v))");
+        agree("\\bstd::(\\w+)", "mystd::x");
+        agree("(a|b)*(.*)e", "abcde");
+        agree("(?:a|b)*(.*)e", "abcde");
+        agree("(a|ab)(c|bcd)(d*)", "abcd");
+        agree("a*?b", "aaab");
+        agree("(a+?)(a*)", "aaaa");
+        agree("x{2,3}", "xxxxx");
+        agree("x{2}y", "xxxy");
+        agree("(x{2,})", "axxxxxb");
+        agree("[a-cx-z_]+", "--abz_q");
+        agree("^ab$", "ab");
+        agree("^ab$", "xab");
+        agree("a.c", "abc");
+        agree("a.c", "a\nc");
+        agree("\\d+\\s\\w", "n 12 ab");
+        agree("[\\d.]+", "pi 3.14!");
+        agree("\\Bb", "ab b");
+        agree("colou?r", "colour color");
+        agree("(\\w+)@(\\w+)\\.com", "mail bob@example.com now");
+        agree("(a*)+", "b");
+        agree("\\x41\\t", "A\t");
+
+        // Thousands of DFA states, far past max_states: the state cache is
+        // dropped and rebuilt along the way.
+        std::string ab;
+        for (unsigned i = 0, x = 1; i < 4000; ++i)
+        {
+            x = x * 1103515245 + 12345;
+            ab += "ab"[(x >> 16) & 1];
+        }
+        agree("[ab]*a[ab]{11}", ab);
+
+        for (const char *bad : {"(left", "left)", "a**", "[a-", "\\1", "x{2,1}", "\\b+", "(?=a)"})
+        {
+            bool threw = false;
+            try
+            {
+                fast_regex rx(bad);
+            }
+            catch (const std::regex_error &)
+            {
+                threw = true;
+            }
+            assert(threw);
+        }
+
+        // One compiled program per pattern and flags.
+        assert(compile_cached("a+", regex_flags::none) == compile_cached("a+", regex_flags::none));
+        assert(compile_cached("a+", regex_flags::none) != compile_cached("a+", regex_flags::icase));
+
+        // A megabyte-long command: std::regex_match would recurse once per
+        // digit here; this is a linear scan.
+        fast_regex  rx("(left|right) ([0-9]+)");
+        fast_match  m;
+        std::string line = "left " + std::string(1 << 20, '7');
+        assert(rx.match(line, m) && m[1] == "left" && m[2].size() == (1 << 20));
+    }
+
+    void
+    bench()
+    {
+        std::vector<std::string> lines;
+        for (int i = 0; i < 200000; ++i)
+        {
+            lines.push_back((i % 3 ? "left " : "right ") + std::to_string(i % 1000));
+        }
+        auto time_one = [&](const char *name, auto f) {
+            auto [sum, s] = bench::timed([&] {
+                size_t sum = 0;
+                for (const auto &line : lines)
+                {
+                    sum += f(line.data(), line.data() + line.size());
+                }
+                return sum;
+            });
+            printf("ex26: %-34s %7.1f ns/line (%zu)\n", name, s * 1e9 / lines.size(), sum);
+        };
+        std::regex rx("(left|right) ([0-9]+)");
+        fast_regex fx("(left|right) ([0-9]+)");
+        time_one("ex10 parse_command", [](const char *p, const char *e) {
+            return ex10::parse_command(p, e).second.size();
+        });
+        time_one("ex26 parse_command", [](const char *p, const char *e) { return parse_command(p, e).second.size(); });
+        time_one("std::regex_match, no captures", [&](const char *p, const char *e) {
+            return std::regex_match(p, e, rx);
+        });
+        time_one("fast_regex::match, no captures", [&](const char *p, const char *e) {
+            return fx.match(std::string_view(p, e - p));
+        });
+    }
+} // namespace ex26
+
+namespace ex27
+{
+    // ex27
+    // ex26's parser is constexpr, so when the pattern is a string literal it
+    // can run at compile time instead. The program it produces becomes a
+    // template argument, and each instruction becomes its own little
+    // function: a literal byte is one compare, and a class under * or + is a
+    // plain loop. What runs is a backtracking matcher with the pattern built
+    // in: no parsing, no allocation, and a bad pattern is a compile error
+    // instead of a std::regex_error.
+    //
+    // Unlike ex26, backtracking can take exponential time on patterns like
+    // "(a|a)*b", and a group under * recurses once per iteration. Patterns
+    // like those belong in ex26.
+    template <size_t N>
+    struct fixed_string
+    {
+        char chars[N] = {};
+
+        constexpr fixed_string(const char (&s)[N])
+        {
+            std::copy_n(s, N, chars);
+        }
+        constexpr std::string_view
+        view() const
+        {
+            return {chars, N - 1};
+        }
+    };
+
+    template <size_t Code, size_t Classes>
+    struct static_program
+    {
+        std::array<ex26::inst, Code>                 code{};
+        std::array<std::array<uint64_t, 4>, Classes> classes{};
+        std::array<int, Classes>                     single{}; // the class's only byte, or -1
+        int                                          groups = 0;
+    };
+
+    template <fixed_string Pattern, ex26::regex_flags Flags>
+    consteval auto
+    compile_static()
+    {
+        constexpr auto sizes = [] {
+            ex26::program p = ex26::compile(Pattern.view(), Flags);
+            return std::pair(p.code.size(), p.classes.size());
+        }();
+        ex26::program                              p = ex26::compile(Pattern.view(), Flags);
+        static_program<sizes.first, sizes.second> out;
+        std::copy(p.code.begin(), p.code.end(), out.code.begin());
+        for (size_t i = 0; i < sizes.second; ++i)
+        {
+            int count = 0;
+            for (int c = 0; c < 256; ++c)
+            {
+                if (p.classes[i].test(c))
+                {
+                    out.classes[i][c >> 6] |= uint64_t(1) << (c & 63);
+                    out.single[i] = c;
+                    ++count;
+                }
+            }
+            if (count != 1)
+            {
+                out.single[i] = -1;
+            }
+        }
+        out.groups = p.groups;
+        return out;
+    }
+
+    template <size_t Groups>
+    class static_match
+    {
+        std::array<std::string_view, Groups> m_groups{};
+        bool                                 m_matched = false;
+
+      public:
+        constexpr static_match() = default;
+        constexpr explicit static_match(const std::array<const char *, 2 * Groups> &caps) : m_matched(true)
+        {
+            for (size_t g = 0; g < Groups; ++g)
+            {
+                const char *b = caps[2 * g], *e = caps[2 * g + 1];
+                m_groups[g]   = (b && e) ? std::string_view(b, e - b) : std::string_view();
+            }
+        }
+
+        constexpr explicit
+        operator bool() const
+        {
+            return m_matched;
+        }
+        static constexpr size_t
+        size()
+        {
+            return Groups;
+        }
+        constexpr bool
+        matched(size_t i) const
+        {
+            return m_groups[i].data() != nullptr;
+        }
+        constexpr std::string_view
+        operator[](size_t i) const
+        {
+            return m_groups[i];
+        }
+    };
+
+    // Successive non-overlapping matches, like std::cregex_iterator. After
+    // an empty match the next search starts one byte further on.
+    template <class Regex>
+    class token_range
+    {
+        std::string_view m_input;
+
+      public:
+        class iterator
+        {
+            std::string_view       m_input;
+            size_t                 m_next = 0;
+            typename Regex::result m_match;
+
+          public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = typename Regex::result;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const value_type *;
+            using reference         = const value_type &;
+
+            constexpr iterator() = default;
+            constexpr explicit iterator(std::string_view s) : m_input(s)
+            {
+                ++*this;
+            }
+
+            constexpr reference
+            operator*() const
+            {
+                return m_match;
+            }
+            constexpr pointer
+            operator->() const
+            {
+                return &m_match;
+            }
+            constexpr iterator &
+            operator++()
+            {
+                if (m_next > m_input.size())
+                {
+                    m_match = {};
+                    return *this;
+                }
+                m_match = Regex::search(m_input, m_next);
+                if (m_match)
+                {
+                    std::string_view whole = m_match[0];
+                    m_next                 = (whole.data() - m_input.data()) + whole.size() + whole.empty();
+                }
+                return *this;
+            }
+            constexpr void
+            operator++(int)
+            {
+                ++*this;
+            }
+            constexpr bool
+            operator==(std::default_sentinel_t) const
+            {
+                return !m_match;
+            }
+        };
+
+        constexpr explicit token_range(std::string_view s) : m_input(s)
+        {
+        }
+        constexpr iterator
+        begin() const
+        {
+            return iterator(m_input);
+        }
+        constexpr std::default_sentinel_t
+        end() const
+        {
+            return {};
+        }
+    };
+
+    template <fixed_string Pattern, ex26::regex_flags Flags = ex26::regex_flags::none>
+    class static_regex
+    {
+        using opcode = ex26::opcode;
+
+        static constexpr auto   prog   = compile_static<Pattern, Flags>();
+        static constexpr int    size   = int(prog.code.size());
+        static constexpr size_t groups = prog.groups + 1;
+
+      public:
+        using result = static_match<groups>;
+
+      private:
+        struct state
+        {
+            const char                                 *begin;
+            const char                                 *end;
+            std::array<const char *, 2 * groups>        caps{};
+            std::array<const char *, prog.code.size()> loops{}; // where each loop's iteration began
+        };
+
+        template <int Class>
+        static constexpr bool
+        test(char c)
+        {
+            unsigned char u = c;
+            if constexpr (prog.single[Class] >= 0)
+            {
+                return u == prog.single[Class];
+            }
+            else
+            {
+                return (prog.classes[Class][u >> 6] >> (u & 63)) & 1;
+            }
+        }
+
+        // A split that a later jmp comes back to.
+        static constexpr bool
+        loop_head(int pc)
+        {
+            for (int i = pc + 1; i < size; ++i)
+            {
+                if (prog.code[i].op == opcode::jmp && prog.code[i].x == pc)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // "c*" or "c*?" for a single class c: iterate instead of recursing.
+        static constexpr bool
+        class_loop(int pc)
+        {
+            return pc + 2 < size && prog.code[pc + 1].op == opcode::cls && prog.code[pc + 2].op == opcode::jmp &&
+                   prog.code[pc + 2].x == pc;
+        }
+
+        // Which bytes can start a match; a search skips the rest.
+        struct first_bytes
+        {
+            std::array<uint64_t, 4> bits{};
+            bool                    nullable = false;
+            int                     single   = -1;
+        };
+        static constexpr first_bytes first = [] {
+            first_bytes            f;
+            std::array<bool, size> seen{};
+            std::vector<int>       stack{0};
+            while (!stack.empty())
+            {
+                int pc = stack.back();
+                stack.pop_back();
+                if (seen[pc])
+                {
+                    continue;
+                }
+                seen[pc]      = true;
+                ex26::inst in = prog.code[pc];
+                switch (in.op)
+                {
+                case opcode::match:
+                    f.nullable = true;
+                    break;
+                case opcode::cls:
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        f.bits[i] |= prog.classes[in.x][i];
+                    }
+                    break;
+                case opcode::jmp:
+                    stack.push_back(in.x);
+                    break;
+                case opcode::split:
+                    stack.push_back(in.x);
+                    stack.push_back(in.y);
+                    break;
+                default:
+                    stack.push_back(pc + 1);
+                    break;
+                }
+            }
+            int count = 0;
+            for (int c = 0; c < 256; ++c)
+            {
+                if ((f.bits[c >> 6] >> (c & 63)) & 1)
+                {
+                    f.single = c;
+                    ++count;
+                }
+            }
+            if (count != 1 || f.nullable)
+            {
+                f.single = -1;
+            }
+            return f;
+        }();
+
+        template <int PC, bool Whole>
+        static constexpr bool
+        run(state &st, const char *sp)
+        {
+            constexpr ex26::inst in = prog.code[PC];
+            if constexpr (in.op == opcode::match)
+            {
+                return !Whole || sp == st.end;
+            }
+            else if constexpr (in.op == opcode::cls)
+            {
+                return sp != st.end && test<in.x>(*sp) && run<PC + 1, Whole>(st, sp + 1);
+            }
+            else if constexpr (in.op == opcode::save)
+            {
+                const char *old = st.caps[in.x];
+                st.caps[in.x]   = sp;
+                if (run<PC + 1, Whole>(st, sp))
+                {
+                    return true;
+                }
+                st.caps[in.x] = old;
+                return false;
+            }
+            else if constexpr (in.op == opcode::jmp)
+            {
+                // Back at a loop head having matched nothing: as in
+                // ECMAScript, an empty iteration fails.
+                if (in.x < PC && sp == st.loops[in.x])
+                {
+                    return false;
+                }
+                return run<in.x, Whole>(st, sp);
+            }
+            else if constexpr (in.op == opcode::split && loop_head(PC))
+            {
+                constexpr bool greedy = (in.x == PC + 1);
+                constexpr int  exit   = greedy ? in.y : in.x;
+                if constexpr (class_loop(PC))
+                {
+                    const char *last = sp;
+                    while (last != st.end && test<prog.code[PC + 1].x>(*last))
+                    {
+                        ++last;
+                    }
+                    for (const char *p = greedy ? last : sp;; greedy ? --p : ++p)
+                    {
+                        if (run<exit, Whole>(st, p))
+                        {
+                            return true;
+                        }
+                        if (p == (greedy ? sp : last))
+                        {
+                            return false;
+                        }
+                    }
+                }
+                else
+                {
+                    const char *saved = st.loops[PC];
+                    if (!greedy && run<exit, Whole>(st, sp))
+                    {
+                        return true;
+                    }
+                    st.loops[PC] = sp;
+                    if (run<PC + 1, Whole>(st, sp))
+                    {
+                        return true;
+                    }
+                    st.loops[PC] = saved;
+                    return greedy && run<exit, Whole>(st, sp);
+                }
+            }
+            else if constexpr (in.op == opcode::split)
+            {
+                return run<in.x, Whole>(st, sp) || run<in.y, Whole>(st, sp);
+            }
+            else
+            {
+                bool prev_word = sp != st.begin && ex26::is_word(sp[-1]);
+                bool next_word = sp != st.end && ex26::is_word(*sp);
+                return ex26::assertion_holds(in.op, sp == st.begin, sp == st.end, prev_word, next_word) &&
+                       run<PC + 1, Whole>(st, sp);
+            }
+        }
+
+        static constexpr std::string_view
+        nonnull(std::string_view s)
+        {
+            return s.data() ? s : std::string_view("");
+        }
+
+      public:
+        static constexpr result
+        match(std::string_view s)
+        {
+            s = nonnull(s);
+            state st{s.data(), s.data() + s.size()};
+            return run<0, true>(st, st.begin) ? result(st.caps) : result();
+        }
+
+        // As in ex26, searching from an offset still lets \b see s[from - 1].
+        static constexpr result
+        search(std::string_view s, size_t from = 0)
+        {
+            s = nonnull(s);
+            state st{s.data(), s.data() + s.size()};
+            for (const char *p = st.begin + from;; ++p)
+            {
+                if constexpr (first.single >= 0)
+                {
+                    p = std::char_traits<char>::find(p, st.end - p, char(first.single));
+                    if (!p)
+                    {
+                        return {};
+                    }
+                }
+                else if constexpr (!first.nullable)
+                {
+                    while (p != st.end && !((first.bits[(unsigned char)*p >> 6] >> (*p & 63)) & 1))
+                    {
+                        ++p;
+                    }
+                    if (p == st.end)
+                    {
+                        return {};
+                    }
+                }
+                if (run<0, false>(st, p))
+                {
+                    return result(st.caps);
+                }
+                if (p == st.end)
+                {
+                    return {};
+                }
+            }
+        }
+
+        static constexpr token_range<static_regex>
+        tokenize(std::string_view s)
+        {
+            return token_range<static_regex>(s);
+        }
+    };
+
+    template <fixed_string Pattern, ex26::regex_flags Flags = ex26::regex_flags::none>
+    constexpr auto
+    match(std::string_view s)
+    {
+        return static_regex<Pattern, Flags>::match(s);
+    }
+
+    template <fixed_string Pattern, ex26::regex_flags Flags = ex26::regex_flags::none>
+    constexpr auto
+    search(std::string_view s, size_t from = 0)
+    {
+        return static_regex<Pattern, Flags>::search(s, from);
+    }
+
+    template <fixed_string Pattern, ex26::regex_flags Flags = ex26::regex_flags::none>
+    constexpr auto
+    tokenize(std::string_view s)
+    {
+        return static_regex<Pattern, Flags>::tokenize(s);
+    }
+
+    std::pair<std::string, std::string>
+    parse_command(const char *p, const char *end)
+    {
+        if (auto m = match<"(left|right) ([0-9]+)">(std::string_view(p, end - p)))
+        {
+            return {std::string(m[1]), std::string(m[2])};
+        }
+        else
+        {
+            throw "Unrecognized command!";
+        }
+    }
+
+    static_assert(match<"(left|right) ([0-9]+)">("right 4")[2] == "4");
+    static_assert(!match<"(left|right) ([0-9]+)">("up 4"));
+    static_assert(search<"\\bb.">("baby")[0] == "ba");
+    // dex27
+
+    // Same groups as ex26, which ex26::test checks against std::regex.
+    template <fixed_string Pattern, ex26::regex_flags Flags = ex26::regex_flags::none>
+    void
+    agree(std::string_view input)
+    {
+        ex26::fast_regex fx(Pattern.view(), Flags);
+        ex26::fast_match fm;
+        for (bool whole : {true, false})
+        {
+            auto m = whole ? match<Pattern, Flags>(input) : search<Pattern, Flags>(input);
+            assert(bool(m) == (whole ? fx.match(input, fm) : fx.search(input, fm)));
+            if (m)
+            {
+                assert(m.size() == fm.size());
+                for (size_t i = 0; i < m.size(); ++i)
+                {
+                    assert(m.matched(i) == fm.matched(i));
+                    assert(m[i].data() == fm[i].data() && m[i].size() == fm[i].size());
+                }
+            }
+        }
+    }
+
+    void
+    test()
+    {
+        char buf[]       = "left 20";
+        auto [dir, dist] = parse_command(buf, buf + 7);
+        assert(dir == "left" && dist == "20");
+
+        for (const char *line : {"left 20", "right 4", "up 3", "left 20x", "left ", ""})
+        {
+            agree<"(left|right) ([0-9]+)">(line);
+        }
+        agree<"((left)|right) (-?[0-9]+)", ex26::regex_flags::icase>("LEFT -3");
+        agree<"((left)|right) (-?[0-9]+)", ex26::regex_flags::icase>("Right 7");
+        for (const char *s : {"baby", "a bb", "ab", "b"})
+        {
+            agree<"\\bb.">(s);
+        }
+        agree<"([0-9]+)|([a-z]+)">("abc123...456...");
+        agree<"([0-9]+)|([a-z]+)">("...456");
+        agree<"\\bstd::(\\w+)">("std::sort(std::begin(v), std::end(v))");
+        agree<"\\bstd::(\\w+)">("mystd::x");
+        agree<"(a|b)*(.*)e">("abcde");
+        agree<"(a|ab)(c|bcd)(d*)">("abcd");
+        agree<"a*?b">("aaab");
+        agree<"(a+?)(a*)">("aaaa");
+        agree<"x{2,3}">("xxxxx");
+        agree<"^ab$">("xab");
+        agree<"\\Bb">("ab b");
+        agree<"(\\w+)@(\\w+)\\.com">("mail bob@example.com now");
+        agree<"(a*)+">("b");
+        agree<"(a|)+b">("aab");
+        agree<"(?:ab)*c">("ababc");
+
+        // ex21, without allocating a single sub_match.
+        std::vector<std::string_view> v;
+        for (const auto &m : tokenize<"([0-9]+)|([a-z]+)">("abc123...456..."))
+        {
+            v.push_back(m.matched(1) ? m[1] : m[2]);
+        }
+        assert((v == std::vector<std::string_view>{"abc", "123", "456"}));
+        v.clear();
+        for (const auto &m : tokenize<"\\bstd::(\\w+)">("std::sort(std::begin(v), std::end(v))"))
+        {
+            v.push_back(m[1]);
+        }
+        assert((v == std::vector<std::string_view>{"sort", "begin", "end"}));
+
+        // A class under + is a loop, not a recursion per byte.
+        std::string line = "left " + std::string(1 << 20, '7');
+        assert(match<"(left|right) ([0-9]+)">(line)[2].size() == (1 << 20));
+    }
+
+    template <fixed_string Pattern>
+    void
+    bench_tokens(std::string_view text)
+    {
+        std::regex       rx(Pattern.chars);
+        ex26::fast_regex fx(Pattern.view());
+        auto [n_std, t_std] = bench::timed([&] {
+            size_t n = 0;
+            for (std::cregex_iterator it(text.data(), text.data() + text.size(), rx), end; it != end; ++it)
+            {
+                ++n;
+            }
+            return n;
+        });
+        auto [n26, t26] = bench::timed([&] {
+            size_t           n = 0, from = 0;
+            ex26::fast_match m;
+            while (from <= text.size() && fx.search(text, m, from))
+            {
+                ++n;
+                from = (m[0].data() - text.data()) + m[0].size() + m[0].empty();
+            }
+            return n;
+        });
+        auto [n27, t27] = bench::timed([&] {
+            size_t n = 0;
+            for (const auto &m : tokenize<Pattern>(text))
+            {
+                n += bool(m);
+            }
+            return n;
+        });
+        assert(n_std == n26 && n26 == n27);
+        printf("ex27: %-22s %6zu matches: std::regex %8.0f us, ex26 %7.0f us, ex27 %7.0f us\n", Pattern.chars, n27,
+               t_std * 1e6, t26 * 1e6, t27 * 1e6);
+    }
+
+    void
+    bench()
+    {
+        std::vector<std::string> lines;
+        for (int i = 0; i < 200000; ++i)
+        {
+            lines.push_back((i % 3 ? "left " : "right ") + std::to_string(i % 1000));
+        }
+        auto time_lines = [&](const char *name, auto f) {
+            auto [sum, s] = bench::timed([&] {
+                size_t sum = 0;
+                for (const auto &line : lines)
+                {
+                    sum += f(line);
+                }
+                return sum;
+            });
+            printf("ex27: %-40s %7.1f ns/line (%zu)\n", name, s * 1e9 / lines.size(), sum);
+        };
+        std::regex       rx("(left|right) ([0-9]+)");
+        ex26::fast_regex fx("(left|right) ([0-9]+)");
+        ex26::fast_match fm;
+        time_lines("(left|right) ([0-9]+), std::regex", [&](const std::string &line) {
+            std::smatch m;
+            return std::regex_match(line, m, rx) ? size_t(m[2].length()) : 0;
+        });
+        time_lines("(left|right) ([0-9]+), ex26", [&](const std::string &line) {
+            return fx.match(line, fm) ? fm[2].size() : 0;
+        });
+        time_lines("(left|right) ([0-9]+), ex27", [&](const std::string &line) {
+            return match<"(left|right) ([0-9]+)">(line)[2].size();
+        });
+
+        auto repeat = [](std::string_view s, size_t bytes) {
+            std::string text;
+            while (text.size() < bytes)
+            {
+                text += s;
+            }
+            return text;
+        };
+        bench_tokens<"\\bb.">(repeat("baby bob about a big bubble ", 1 << 16));
+        bench_tokens<"\\bstd::(\\w+)">(repeat("std::sort(std::begin(v), std::end(v)); ", 1 << 16));
+        bench_tokens<"([0-9]+)|([a-z]+)">(repeat("abc123...456...", 1 << 16));
+    }
+} // namespace ex27
+
 int
 main()
 {
@@ -643,4 +2793,9 @@ main()
     ex22::test();
     ex23::test();
     ex24::test();
+    ex25::test();
+    ex26::test();
+    ex26::bench();
+    ex27::test();
+    ex27::bench();
 }
@@ -0,0 +1,52 @@
+#pragma once
+
+// The stopwatch behind every bench() in the book: run a callable once and
+// return what it returned along with the wall-clock seconds it took.
+//
+//     auto [lines, s] = bench::timed([&] { return count_lines(fd); });
+//     printf("%-12s %6.2f GB/s (%zu lines)\n", name, bytes / s / 1e9, lines);
+//
+// A callable that returns nothing gives just the seconds. Keeping the
+// result alive (and printing it) stops the optimizer from discarding the
+// work being measured.
+
+#include <chrono>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace bench
+{
+    template <class T>
+    struct timing
+    {
+        T      value;
+        double seconds;
+    };
+
+    template <>
+    struct timing<void>
+    {
+        double seconds;
+    };
+
+    template <class F>
+    auto
+    timed(F &&f)
+    {
+        using clock  = std::chrono::steady_clock;
+        using result = std::invoke_result_t<F &>;
+        auto t0      = clock::now();
+        auto since   = [t0] { return std::chrono::duration<double>(clock::now() - t0).count(); };
+        if constexpr (std::is_void_v<result>)
+        {
+            std::invoke(f);
+            return timing<void>{since()};
+        }
+        else
+        {
+            result value = std::invoke(f);
+            return timing<result>{std::move(value), since()};
+        }
+    }
+} // namespace bench
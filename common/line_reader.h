@@ -0,0 +1,178 @@
+#pragma once
+
+// A getline replacement that reads a file descriptor in large blocks and
+// hands out lines as string_views into its own buffer. Newlines are found
+// with memchr, so no per-character stream calls and no copy per line.
+//
+//     fastio::line_reader in(STDIN_FILENO);
+//     std::string_view    line;
+//     while (getline(in, line))
+//     {
+//         process(line);
+//     }
+//
+// Like std::getline, the '\n' is stripped and a last line without one is
+// still returned. A view is valid only until the next line is read. Reading
+// fd 0 directly skips anything already buffered by std::cin or stdin, so
+// don't mix the two on one descriptor.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
+
+namespace fastio
+{
+    class line_reader
+    {
+        int                     m_fd;
+        std::unique_ptr<char[]> m_buffer;
+        size_t                  m_capacity;
+        char                   *m_begin; // first unread byte
+        char                   *m_scan;  // no '\n' in [m_begin, m_scan)
+        char                   *m_end;   // end of the bytes read so far
+        bool                    m_eof = false;
+
+        // Keep the unread tail, growing the buffer if one line fills it.
+        void
+        refill()
+        {
+            size_t kept    = m_end - m_begin;
+            size_t scanned = m_scan - m_begin;
+            if (kept == m_capacity)
+            {
+                auto bigger = std::make_unique_for_overwrite<char[]>(2 * m_capacity);
+                std::memcpy(bigger.get(), m_begin, kept);
+                m_buffer = std::move(bigger);
+                m_capacity *= 2;
+            }
+            else if (m_begin != m_buffer.get())
+            {
+                std::memmove(m_buffer.get(), m_begin, kept);
+            }
+            m_begin = m_buffer.get();
+            m_scan  = m_begin + scanned;
+            m_end   = m_begin + kept;
+
+            ssize_t n;
+            do
+            {
+                n = ::read(m_fd, m_end, m_capacity - kept);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "read");
+            }
+            m_eof = (n == 0);
+            m_end += n;
+        }
+
+      public:
+        explicit line_reader(int fd, size_t buffer_size = 1 << 20)
+            : m_fd(fd), m_buffer(std::make_unique_for_overwrite<char[]>(std::max<size_t>(buffer_size, 1))),
+              m_capacity(std::max<size_t>(buffer_size, 1)), m_begin(m_buffer.get()), m_scan(m_begin), m_end(m_begin)
+        {
+        }
+
+        line_reader(const line_reader &) = delete;
+
+        bool
+        next(std::string_view &line)
+        {
+            while (true)
+            {
+                if (auto *nl = static_cast<char *>(std::memchr(m_scan, '\n', m_end - m_scan)))
+                {
+                    line    = std::string_view(m_begin, nl - m_begin);
+                    m_begin = m_scan = nl + 1;
+                    return true;
+                }
+                m_scan = m_end;
+                if (m_eof)
+                {
+                    if (m_begin == m_end)
+                    {
+                        return false;
+                    }
+                    line    = std::string_view(m_begin, m_end - m_begin);
+                    m_begin = m_end;
+                    return true;
+                }
+                refill();
+            }
+        }
+
+        class iterator
+        {
+            line_reader     *m_reader = nullptr;
+            std::string_view m_line;
+
+          public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = std::string_view;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const std::string_view *;
+            using reference         = const std::string_view &;
+
+            iterator() = default;
+            explicit iterator(line_reader *r) : m_reader(r)
+            {
+                ++*this;
+            }
+
+            reference
+            operator*() const
+            {
+                return m_line;
+            }
+            pointer
+            operator->() const
+            {
+                return &m_line;
+            }
+            iterator &
+            operator++()
+            {
+                if (!m_reader->next(m_line))
+                {
+                    m_reader = nullptr;
+                }
+                return *this;
+            }
+            void
+            operator++(int)
+            {
+                ++*this;
+            }
+            bool
+            operator==(std::default_sentinel_t) const
+            {
+                return m_reader == nullptr;
+            }
+        };
+
+        iterator
+        begin()
+        {
+            return iterator(this);
+        }
+        std::default_sentinel_t
+        end()
+        {
+            return {};
+        }
+    };
+
+    // So that "while (std::getline(std::cin, line))" becomes
+    // "while (getline(in, line))".
+    inline bool
+    getline(line_reader &in, std::string_view &line)
+    {
+        return in.next(line);
+    }
+} // namespace fastio
@@ -0,0 +1,499 @@
+#include "pool_new.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+// Every block is preceded by a 16-byte header saying where it came from, so
+// that unsized and sized deletes alike can route it back without a lookup.
+// Requests up to max_small bytes are served from per-thread free lists, one
+// per 16-byte size class; those lists refill from (and spill back to)
+// mutex-protected central lists in batches, which in turn carve new blocks
+// out of slabs obtained from malloc. Everything else goes straight to malloc.
+
+namespace
+{
+    constexpr std::size_t header_size = 16;
+    constexpr std::size_t granule     = 16;
+    constexpr std::size_t max_small   = 512;
+    constexpr int         num_classes = max_small / granule;
+    constexpr int         batch       = 32;
+    constexpr std::size_t slab_size   = 64 * 1024;
+
+    constexpr std::uint32_t large_block   = 0xFFFFFFFF;
+    constexpr std::uint32_t aligned_block = 0xFFFFFFFE;
+
+    struct header
+    {
+        std::uint32_t kind;   // size class, large_block or aligned_block
+        std::uint32_t offset; // aligned blocks: distance back to the malloc'd pointer
+        std::uint64_t unused;
+    };
+    static_assert(sizeof(header) == header_size);
+
+    struct free_block
+    {
+        free_block *next;
+    };
+
+    header *
+    header_of(void *p)
+    {
+        return reinterpret_cast<header *>(static_cast<char *>(p) - header_size);
+    }
+
+    int
+    class_of(std::size_t n)
+    {
+        return n == 0 ? 0 : int((n - 1) / granule);
+    }
+
+    // A thread's counters are written only by that thread, so relaxed loads
+    // and stores suffice; snapshot() reads them concurrently from others.
+    struct counters
+    {
+        using counter = std::atomic<std::uint64_t>;
+
+        counter allocations{0};
+        counter deallocations{0};
+        counter bytes_requested{0};
+        counter large{0};
+        counter refills{0};
+    };
+
+    // Trivially destructible, so it stays usable while other thread_local
+    // destructors (which may well call operator delete) are running.
+    struct thread_cache
+    {
+        free_block   *heads[num_classes]  = {};
+        int           counts[num_classes] = {};
+        counters      stats;
+        bool          registered = false;
+        bool          dead       = false;
+        thread_cache *next_live  = nullptr;
+    };
+
+    thread_local thread_cache t_cache;
+
+    struct central_list
+    {
+        std::mutex  mtx;
+        free_block *head = nullptr;
+    };
+
+    central_list s_central[num_classes];
+
+    std::mutex                 s_registry_mtx;
+    thread_cache              *s_live = nullptr;
+    counters                   s_retired; // exited threads, and threads past their teardown
+    std::atomic<std::uint64_t> s_slab_bytes{0};
+
+    void
+    add(counters &to, const counters &from)
+    {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        to.allocations.fetch_add(from.allocations.load(relaxed), relaxed);
+        to.deallocations.fetch_add(from.deallocations.load(relaxed), relaxed);
+        to.bytes_requested.fetch_add(from.bytes_requested.load(relaxed), relaxed);
+        to.large.fetch_add(from.large.load(relaxed), relaxed);
+        to.refills.fetch_add(from.refills.load(relaxed), relaxed);
+    }
+
+    void
+    push_central(int cls, free_block *first, free_block *last)
+    {
+        std::lock_guard lk(s_central[cls].mtx);
+        last->next          = s_central[cls].head;
+        s_central[cls].head = first;
+    }
+
+    // Give back everything this thread is holding; runs at thread exit.
+    struct thread_exit_guard
+    {
+        ~thread_exit_guard()
+        {
+            thread_cache &c = t_cache;
+            for (int cls = 0; cls < num_classes; ++cls)
+            {
+                if (free_block *first = c.heads[cls])
+                {
+                    free_block *last = first;
+                    while (last->next)
+                    {
+                        last = last->next;
+                    }
+                    push_central(cls, first, last);
+                    c.heads[cls]  = nullptr;
+                    c.counts[cls] = 0;
+                }
+            }
+            std::lock_guard lk(s_registry_mtx);
+            for (thread_cache **pp = &s_live; *pp; pp = &(*pp)->next_live)
+            {
+                if (*pp == &c)
+                {
+                    *pp = c.next_live;
+                    break;
+                }
+            }
+            add(s_retired, c.stats);
+            c.dead = true;
+        }
+    };
+
+    thread_local thread_exit_guard t_guard;
+
+    void
+    register_thread(thread_cache &c)
+    {
+        (void)&t_guard; // make sure the guard is constructed for this thread
+        std::lock_guard lk(s_registry_mtx);
+        c.registered = true;
+        c.next_live  = s_live;
+        s_live       = &c;
+    }
+
+    // Charges n to one of the calling thread's counters. A thread joins the
+    // registry on its first call, whatever the call is for; once its cache
+    // has been torn down, it charges the shared s_retired instead.
+    void
+    count(thread_cache &c, counters::counter counters::*which, std::uint64_t n = 1)
+    {
+        if (c.dead)
+        {
+            (s_retired.*which).fetch_add(n, std::memory_order_relaxed);
+            return;
+        }
+        if (!c.registered)
+        {
+            register_thread(c);
+        }
+        counters::counter &v = c.stats.*which;
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // Fetch a batch from the central list, carving a new slab if it's empty.
+    bool
+    refill(thread_cache &c, int cls)
+    {
+        count(c, &counters::refills);
+
+        std::size_t block = header_size + (cls + 1) * granule;
+        {
+            std::lock_guard lk(s_central[cls].mtx);
+            free_block     *head = s_central[cls].head;
+            int             n    = 0;
+            while (head && n < batch)
+            {
+                free_block *next = head->next;
+                head->next       = c.heads[cls];
+                c.heads[cls]     = head;
+                head             = next;
+                ++n;
+            }
+            s_central[cls].head = head;
+            c.counts[cls] += n;
+            if (n != 0)
+            {
+                return true;
+            }
+        }
+
+        char *slab = static_cast<char *>(std::malloc(slab_size));
+        if (slab == nullptr)
+        {
+            return false;
+        }
+        s_slab_bytes.fetch_add(slab_size, std::memory_order_relaxed);
+        for (char *p = slab; p + block <= slab + slab_size; p += block)
+        {
+            auto *h      = reinterpret_cast<header *>(p);
+            h->kind      = std::uint32_t(cls);
+            auto *b      = reinterpret_cast<free_block *>(p + header_size);
+            b->next      = c.heads[cls];
+            c.heads[cls] = b;
+            ++c.counts[cls];
+        }
+        return true;
+    }
+
+    void *
+    allocate_large(std::size_t n, std::size_t align)
+    {
+        count(t_cache, &counters::large);
+        if (n > SIZE_MAX - header_size - align)
+        {
+            return nullptr; // the header (and padding) would wrap the size around
+        }
+        if (align <= header_size)
+        {
+            char *raw = static_cast<char *>(std::malloc(header_size + n));
+            if (raw == nullptr)
+            {
+                return nullptr;
+            }
+            reinterpret_cast<header *>(raw)->kind = large_block;
+            return raw + header_size;
+        }
+        char *raw = static_cast<char *>(std::malloc(header_size + n + align));
+        if (raw == nullptr)
+        {
+            return nullptr;
+        }
+        char *p = raw + header_size;
+        p += -reinterpret_cast<std::uintptr_t>(p) % align;
+        header_of(p)->kind   = aligned_block;
+        header_of(p)->offset = std::uint32_t(p - raw);
+        return p;
+    }
+
+    void *
+    allocate(std::size_t n, std::size_t align) noexcept
+    {
+        thread_cache &c = t_cache;
+        count(c, &counters::allocations);
+        count(c, &counters::bytes_requested, n);
+        if (n > max_small || align > header_size || c.dead)
+        {
+            return allocate_large(n, align);
+        }
+        int cls = class_of(n);
+        if (c.heads[cls] == nullptr && !refill(c, cls))
+        {
+            return nullptr;
+        }
+        free_block *b = c.heads[cls];
+        c.heads[cls]  = b->next;
+        --c.counts[cls];
+        return b;
+    }
+
+    void
+    deallocate(void *p) noexcept
+    {
+        if (p == nullptr)
+        {
+            return;
+        }
+        thread_cache &c = t_cache;
+        count(c, &counters::deallocations);
+        header *h = header_of(p);
+        if (h->kind == large_block)
+        {
+            std::free(h);
+            return;
+        }
+        if (h->kind == aligned_block)
+        {
+            std::free(static_cast<char *>(p) - h->offset);
+            return;
+        }
+        int   cls = int(h->kind);
+        auto *b   = static_cast<free_block *>(p);
+        if (c.dead)
+        {
+            push_central(cls, b, b);
+            return;
+        }
+        b->next      = c.heads[cls];
+        c.heads[cls] = b;
+        if (++c.counts[cls] > 2 * batch)
+        {
+            // Too many cached here (a consumer thread freeing what a
+            // producer allocated, say); hand a batch back.
+            free_block *first = c.heads[cls];
+            free_block *last  = first;
+            for (int i = 1; i < batch; ++i)
+            {
+                last = last->next;
+            }
+            c.heads[cls] = last->next;
+            c.counts[cls] -= batch;
+            push_central(cls, first, last);
+        }
+    }
+
+    void *
+    allocate_or_throw(std::size_t n, std::size_t align)
+    {
+        while (true)
+        {
+            if (void *p = allocate(n, align))
+            {
+                return p;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+
+    struct exit_reporter
+    {
+        ~exit_reporter()
+        {
+            const char *env = std::getenv("POOL_NEW_STATS");
+            if (env != nullptr && *env != '\0' && *env != '0')
+            {
+                pool_new::print_stats(stderr);
+            }
+        }
+    } s_exit_reporter;
+} // namespace
+
+namespace pool_new
+{
+    stats
+    snapshot()
+    {
+        constexpr auto  relaxed = std::memory_order_relaxed;
+        counters        total;
+        std::lock_guard lk(s_registry_mtx);
+        add(total, s_retired);
+        for (thread_cache *c = s_live; c; c = c->next_live)
+        {
+            add(total, c->stats);
+        }
+        return stats{total.allocations.load(relaxed), total.deallocations.load(relaxed),
+                     total.bytes_requested.load(relaxed), total.large.load(relaxed),
+                     total.refills.load(relaxed), s_slab_bytes.load(relaxed)};
+    }
+
+    void
+    print_stats(FILE *fp)
+    {
+        stats s = snapshot();
+        fprintf(fp,
+                "pool_new: %llu allocations, %llu deallocations, %llu bytes requested, "
+                "%llu large, %llu refills, %llu slab bytes\n",
+                (unsigned long long)s.allocations, (unsigned long long)s.deallocations,
+                (unsigned long long)s.bytes_requested, (unsigned long long)s.large, (unsigned long long)s.refills,
+                (unsigned long long)s.slab_bytes);
+    }
+} // namespace pool_new
+
+void *
+operator new(std::size_t n)
+{
+    return allocate_or_throw(n, alignof(std::max_align_t));
+}
+
+void *
+operator new[](std::size_t n)
+{
+    return allocate_or_throw(n, alignof(std::max_align_t));
+}
+
+void *
+operator new(std::size_t n, const std::nothrow_t &) noexcept
+{
+    return allocate(n, alignof(std::max_align_t));
+}
+
+void *
+operator new[](std::size_t n, const std::nothrow_t &) noexcept
+{
+    return allocate(n, alignof(std::max_align_t));
+}
+
+void *
+operator new(std::size_t n, std::align_val_t align)
+{
+    return allocate_or_throw(n, std::size_t(align));
+}
+
+void *
+operator new[](std::size_t n, std::align_val_t align)
+{
+    return allocate_or_throw(n, std::size_t(align));
+}
+
+void *
+operator new(std::size_t n, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return allocate(n, std::size_t(align));
+}
+
+void *
+operator new[](std::size_t n, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return allocate(n, std::size_t(align));
+}
+
+void
+operator delete(void *p) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete[](void *p) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete(void *p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete[](void *p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete(void *p, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete[](void *p, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    deallocate(p);
+}
+
+void
+operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    deallocate(p);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Replacement global operator new/delete backed by a thread-caching pool.
+//
+// It is selected at link time: build a chapter with
+//
+//     meson setup build -Dpool_new=true
+//
+// and every allocation in the program, including those made through
+// std::allocator, goes through the pool. Set POOL_NEW_STATS=1 in the
+// environment to print the counters below when the program exits.
+
+#include <cstdint>
+#include <cstdio>
+
+namespace pool_new
+{
+    struct stats
+    {
+        std::uint64_t allocations;     // every operator new
+        std::uint64_t deallocations;   // every operator delete of a non-null pointer
+        std::uint64_t bytes_requested; // sum of the sizes passed to operator new
+        std::uint64_t large;           // requests too big (or too aligned) for the pool
+        std::uint64_t refills;         // thread cache refills from the central lists
+        std::uint64_t slab_bytes;      // memory carved into pool blocks so far
+    };
+
+    // Sums the counters of every live thread and of every thread that has exited,
+    // including operations made during thread exit after its cache was torn down.
+    // Safe to call from any thread.
+    stats snapshot();
+
+    void print_stats(FILE *fp);
+} // namespace pool_new